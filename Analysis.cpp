@@ -0,0 +1,220 @@
+#include "Analysis.hpp"
+
+#include <llvm/ADT/StringSwitch.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+struct BodySummary
+{
+    bool hasLoop = false;
+    bool hasParallelLoop = false;
+    std::vector<const Function*> callees;
+    /// Returned expressions.
+    std::vector<const Expression*> returns;
+};
+
+bool isSelfCall(const Expression& expression, const Function& function)
+{
+    auto* call = dynamic_cast<const CallExpression*>(&expression);
+    return call && call->function == &function;
+}
+
+/// The operation combining recursive calls for 'FunctionProperties::accumulator'.
+std::optional<Token::TokenType> accumulator(const Function& function, const BodySummary& summary)
+{
+    if (isFloatingPoint(function.returnType) || function.returnType == Type::Bool)
+    {
+        return std::nullopt;
+    }
+    std::optional<Token::TokenType> result;
+    for (const Expression* iter : summary.returns)
+    {
+        auto* binary = dynamic_cast<const BinaryExpression*>(iter);
+        if (!binary || (binary->operation != Token::Plus && binary->operation != Token::Times)
+            || (!isSelfCall(*binary->lhs, function) && !isSelfCall(*binary->rhs, function)))
+        {
+            continue;
+        }
+        if (result && *result != binary->operation)
+        {
+            return std::nullopt;
+        }
+        result = binary->operation;
+    }
+    return result;
+}
+
+void summarize(const Expression& expression, BodySummary& summary)
+{
+    std::vector<const Expression*> work{&expression};
+    while (!work.empty())
+    {
+        const Expression* current = work.back();
+        work.pop_back();
+        if (auto* call = dynamic_cast<const CallExpression*>(current))
+        {
+            summary.callees.push_back(call->function);
+        }
+        forEachOperand(*current, [&](const Expression& operand) { work.push_back(&operand); });
+    }
+}
+
+void summarize(const std::vector<Statement>& statements, BodySummary& summary)
+{
+    for (auto& iter : statements)
+    {
+        if (auto* ret = std::get_if<Statement::ReturnStatement>(&iter.variant))
+        {
+            summary.returns.push_back(ret->expression.get());
+            summarize(*ret->expression, summary);
+        }
+        else if (auto* expr = std::get_if<std::unique_ptr<Expression>>(&iter.variant))
+        {
+            summarize(**expr, summary);
+        }
+        else if (auto* varDecl = std::get_if<std::unique_ptr<VarDecl>>(&iter.variant))
+        {
+            if ((*varDecl)->initializer)
+            {
+                summarize(*(*varDecl)->initializer, summary);
+            }
+        }
+        else if (auto* assignment = std::get_if<Statement::Assignment>(&iter.variant))
+        {
+            summarize(*assignment->value, summary);
+        }
+        else if (auto* ifStmt = std::get_if<Statement::IfStatement>(&iter.variant))
+        {
+            summarize(*ifStmt->condition, summary);
+            summarize(ifStmt->body, summary);
+        }
+        else if (auto* whileStmt = std::get_if<Statement::WhileStatement>(&iter.variant))
+        {
+            summary.hasLoop = true;
+            summarize(*whileStmt->condition, summary);
+            summarize(whileStmt->body, summary);
+        }
+        else if (auto* parallelFor = std::get_if<Statement::ParallelFor>(&iter.variant))
+        {
+            summary.hasParallelLoop = true;
+            summarize(*parallelFor->begin, summary);
+            summarize(*parallelFor->end, summary);
+            summarize(parallelFor->body, summary);
+        }
+    }
+}
+
+} // namespace
+
+std::optional<llvm::Intrinsic::ID> mathIntrinsic(const Function& function)
+{
+    if (!function.external)
+    {
+        return std::nullopt;
+    }
+    llvm::StringRef name = function.identifier;
+    Type type = Type::Double;
+    if (name.size() > 1 && name.back() == 'f')
+    {
+        type = Type::Float;
+        name = name.drop_back();
+    }
+    struct Entry
+    {
+        llvm::Intrinsic::ID id;
+        std::size_t arity;
+    };
+    auto entry = llvm::StringSwitch<std::optional<Entry>>(name)
+                     .Case("sqrt", Entry{llvm::Intrinsic::sqrt, 1})
+                     .Case("sin", Entry{llvm::Intrinsic::sin, 1})
+                     .Case("cos", Entry{llvm::Intrinsic::cos, 1})
+                     .Case("exp", Entry{llvm::Intrinsic::exp, 1})
+                     .Case("exp2", Entry{llvm::Intrinsic::exp2, 1})
+                     .Case("log", Entry{llvm::Intrinsic::log, 1})
+                     .Case("log2", Entry{llvm::Intrinsic::log2, 1})
+                     .Case("log10", Entry{llvm::Intrinsic::log10, 1})
+                     .Case("fabs", Entry{llvm::Intrinsic::fabs, 1})
+                     .Case("floor", Entry{llvm::Intrinsic::floor, 1})
+                     .Case("ceil", Entry{llvm::Intrinsic::ceil, 1})
+                     .Case("trunc", Entry{llvm::Intrinsic::trunc, 1})
+                     .Case("round", Entry{llvm::Intrinsic::round, 1})
+                     .Case("rint", Entry{llvm::Intrinsic::rint, 1})
+                     .Case("nearbyint", Entry{llvm::Intrinsic::nearbyint, 1})
+                     .Case("pow", Entry{llvm::Intrinsic::pow, 2})
+                     .Case("fmin", Entry{llvm::Intrinsic::minnum, 2})
+                     .Case("fmax", Entry{llvm::Intrinsic::maxnum, 2})
+                     .Case("copysign", Entry{llvm::Intrinsic::copysign, 2})
+                     .Case("fma", Entry{llvm::Intrinsic::fma, 3})
+                     .Default(std::nullopt);
+    if (!entry || function.parameters.size() != entry->arity || function.returnType != type
+        || std::any_of(function.parameters.begin(), function.parameters.end(),
+                       [&](const auto& parameter) { return parameter->type != type; }))
+    {
+        return std::nullopt;
+    }
+    return entry->id;
+}
+
+const FunctionProperties& FunctionAnalysis::analyze(const Function& function)
+{
+    if (function.external)
+    {
+        if (m_properties.size() <= function.index)
+        {
+            m_properties.resize(function.index + 1);
+        }
+        bool intrinsic = mathIntrinsic(function).has_value();
+        auto& properties = m_properties[function.index];
+        properties = FunctionProperties();
+        properties.noMemoryEffects = intrinsic;
+        properties.noRecurse = intrinsic;
+        properties.noCallbacks = intrinsic;
+        properties.willReturn = intrinsic;
+        return properties;
+    }
+
+    BodySummary summary;
+    summarize(function.body, summary);
+
+    // Start from the most optimistic assumption. Variables live on the function's own stack, so only callees can
+    // introduce memory effects. 'parallel for' calls into the runtime, which synchronizes with other threads.
+    FunctionProperties properties;
+    properties.noMemoryEffects = !summary.hasParallelLoop;
+    properties.noRecurse = true;
+    properties.noCallbacks = true;
+    properties.willReturn = !summary.hasLoop && !summary.hasParallelLoop;
+    for (const Function* callee : summary.callees)
+    {
+        if (callee == &function)
+        {
+            properties.noRecurse = false;
+            properties.willReturn = false;
+            continue;
+        }
+        assert(callee->index < m_properties.size() && "callee must have been analyzed before its callers");
+        static const FunctionProperties unknown;
+        const auto& calleeProperties =
+            m_redefinableCallees && !callee->external ? unknown : m_properties[callee->index];
+        properties.noMemoryEffects &= calleeProperties.noMemoryEffects;
+        properties.willReturn &= calleeProperties.willReturn;
+        properties.noCallbacks &= calleeProperties.noCallbacks;
+    }
+    // Functions of the file only call functions defined before them, so apart from calling itself a function can only
+    // be re-entered through an 'extern' function it reaches, directly or not, calling an exported function.
+    properties.noRecurse &= properties.noCallbacks;
+
+    if (properties.noMemoryEffects)
+    {
+        properties.accumulator = accumulator(function, summary);
+    }
+
+    if (m_properties.size() <= function.index)
+    {
+        m_properties.resize(function.index + 1);
+    }
+    m_properties[function.index] = properties;
+    return m_properties[function.index];
+}
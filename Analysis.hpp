@@ -0,0 +1,60 @@
+#pragma once
+
+#include <llvm/IR/Intrinsics.h>
+
+#include <optional>
+#include <vector>
+
+#include "Syntax.hpp"
+
+/// Facts about a 'Function' derived from its body and from the facts about every function it calls.
+struct FunctionProperties
+{
+    /// Neither reads nor writes any memory visible to its caller.
+    bool noMemoryEffects = false;
+    /// Never re-entered while it is executing, neither directly nor through other functions. For 'extern' functions:
+    /// Never calls back into functions of the file.
+    bool noRecurse = false;
+    /// Only calls 'extern' functions that never call back into functions of the file, neither directly nor through
+    /// other functions. A function of the file calling one that might is not 'noRecurse', as it may be re-entered
+    /// through the callback.
+    bool noCallbacks = false;
+    /// Always returns to its caller: It contains no loops, is not recursive and only calls functions that always
+    /// return.
+    bool willReturn = false;
+    /// Set to '+' or '*' if the function returns 'f(...) op e' or 'e op f(...)', 'f' being the function itself, using
+    /// the same integer operation 'op' in every such 'return'. As the operation is associative and commutative, the
+    /// recursion can be carried out as a loop that combines the 'e's into an accumulator, starting out as the identity
+    /// of 'op' and combined with the value of the first other 'return' reached. Only set without memory effects, since
+    /// the loop evaluates every 'e' before, instead of after, the recursive call.
+    std::optional<Token::TokenType> accumulator;
+};
+
+/// If 'function' is an 'extern' declaration of one of the libm functions LLVM has an intrinsic for, with the signature
+/// of either its 'double' or its 'float' variant, returns that intrinsic. SimpleC has no 'errno', so the intrinsics,
+/// which never set it, compute the same result.
+std::optional<llvm::Intrinsic::ID> mathIntrinsic(const Function& function);
+
+/// Infers 'FunctionProperties' over the call graph of a file. Functions may only call themselves or functions defined
+/// before them, so the only cycles in the call graph are direct self recursion and functions can be analyzed one at a
+/// time, in order of definition.
+class FunctionAnalysis
+{
+    std::vector<FunctionProperties> m_properties;
+    bool m_redefinableCallees = false;
+
+public:
+    /// With 'redefinableCallees', the functions of the file may be replaced after their callers were analyzed, as in
+    /// the REPL. Calls to them are then assumed to do anything, like calls to 'extern' functions, so that no property
+    /// of a caller depends on the current definition of one of its callees.
+    explicit FunctionAnalysis(bool redefinableCallees = false) : m_redefinableCallees(redefinableCallees) {}
+
+    /// Analyzes 'function'. Every function it calls, except itself, must have been analyzed before. Calls to 'extern'
+    /// functions are assumed to do anything, unless they are a 'mathIntrinsic'.
+    const FunctionProperties& analyze(const Function& function);
+
+    [[nodiscard]] const FunctionProperties& get(const Function& function) const
+    {
+        return m_properties[function.index];
+    }
+};
@@ -1,42 +1,274 @@
 #include "Codegen.hpp"
 
-#include <llvm/Target/TargetMachine.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
-Codegen::Codegen(llvm::LLVMContext& context) : m_builder(context)
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+unsigned fastMathBits(const llvm::FastMathFlags& flags)
+{
+    return flags.allowReassoc() | flags.noNaNs() << 1 | flags.noInfs() << 2 | flags.noSignedZeros() << 3
+           | flags.allowReciprocal() << 4 | flags.allowContract() << 5 | flags.approxFunc() << 6;
+}
+
+} // namespace
+
+bool CodegenOptions::operator==(const CodegenOptions& other) const
+{
+    return fastMathBits(fastMath) == fastMathBits(other.fastMath) && batchEntryPoints == other.batchEntryPoints
+           && debugInfo == other.debugInfo && sourceFileName == other.sourceFileName && instrument == other.instrument
+           && instrumentCycles == other.instrumentCycles && foldConstantCalls == other.foldConstantCalls
+           && multiversion == other.multiversion && versionLevels == other.versionLevels;
+}
+
+llvm::hash_code hash_value(const CodegenOptions& options)
+{
+    return llvm::hash_combine(fastMathBits(options.fastMath), options.batchEntryPoints, options.debugInfo,
+                              options.sourceFileName, options.instrument, options.instrumentCycles,
+                              options.foldConstantCalls,
+                              llvm::hash_combine_range(options.multiversion.begin(), options.multiversion.end()),
+                              llvm::hash_combine_range(options.versionLevels.begin(), options.versionLevels.end()));
+}
+
+Codegen::Codegen(llvm::LLVMContext& context, const llvm::TargetMachine* targetMachine, CodegenOptions options,
+                 FunctionAnalysis* analysis)
+    : m_targetMachine(targetMachine),
+      m_options(options),
+      m_builder(context),
+      m_analysis(analysis ? *analysis : m_ownAnalysis)
 {
+    m_builder.setFastMathFlags(m_options.fastMath);
     m_module = std::make_unique<llvm::Module>("", context);
+    if (m_targetMachine)
+    {
+        m_module->setTargetTriple(m_targetMachine->getTargetTriple().str());
+        m_module->setDataLayout(m_targetMachine->createDataLayout());
+    }
+    if (m_options.debugInfo)
+    {
+        m_module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+        m_module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+        m_debugBuilder = std::make_unique<llvm::DIBuilder>(*m_module);
+        m_debugFile = m_debugBuilder->createFile(llvm::sys::path::filename(m_options.sourceFileName),
+                                                 llvm::sys::path::parent_path(m_options.sourceFileName));
+        m_debugBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, m_debugFile, "SimpleC", false, "", 0);
+    }
+}
+
+void Codegen::addSubprogram(llvm::Function& function, llvm::StringRef name, std::size_t line)
+{
+    if (!m_debugBuilder)
+    {
+        return;
+    }
+    // Only line info is emitted, so there is no need to describe parameter and return types.
+    auto* type = m_debugBuilder->createSubroutineType(m_debugBuilder->getOrCreateTypeArray({}));
+    function.setSubprogram(m_debugBuilder->createFunction(m_debugFile, name, function.getName(), m_debugFile, line,
+                                                          type, line, llvm::DINode::FlagPrototyped,
+                                                          llvm::DISubprogram::SPFlagDefinition));
 }
 
 llvm::Type* Codegen::visit(const Type& type)
 {
     switch (type)
     {
+        case Type::Bool: return llvm::Type::getInt1Ty(m_module->getContext());
+        case Type::Int8: return llvm::Type::getInt8Ty(m_module->getContext());
+        case Type::Int16: return llvm::Type::getInt16Ty(m_module->getContext());
         case Type::Integer: return llvm::IntegerType::get(m_module->getContext(), sizeof(int) * __CHAR_BIT__);
+        case Type::Int64: return llvm::Type::getInt64Ty(m_module->getContext());
+        case Type::Float: return llvm::Type::getFloatTy(m_module->getContext());
         case Type::Double: return llvm::Type::getDoubleTy(m_module->getContext());
-        default: assert(false);
+        case Type::Vec2Int:
+        case Type::Vec4Int:
+        case Type::Vec8Int:
+        case Type::Vec2Double:
+        case Type::Vec4Double:
+        case Type::Vec8Double: return llvm::FixedVectorType::get(visit(elementType(type)), laneCount(type));
     }
+    llvm_unreachable("unknown type");
 }
 
-void Codegen::visit(const Function& function)
+void Codegen::addTargetAttributes(llvm::Function& function)
+{
+    if (m_targetMachine && !m_targetMachine->getTargetCPU().empty())
+    {
+        function.addFnAttr("target-cpu", m_targetMachine->getTargetCPU());
+    }
+    if (m_targetMachine && !m_targetMachine->getTargetFeatureString().empty())
+    {
+        function.addFnAttr("target-features", m_targetMachine->getTargetFeatureString());
+    }
+
+    // The backend does not look at the fast-math flags of instructions for every transformation, so mirror them as
+    // function attributes the same way clang does.
+    const auto& fastMath = m_options.fastMath;
+    if (fastMath.noNaNs())
+    {
+        function.addFnAttr("no-nans-fp-math", "true");
+    }
+    if (fastMath.noInfs())
+    {
+        function.addFnAttr("no-infs-fp-math", "true");
+    }
+    if (fastMath.noSignedZeros())
+    {
+        function.addFnAttr("no-signed-zeros-fp-math", "true");
+    }
+    if (fastMath.approxFunc())
+    {
+        function.addFnAttr("approx-func-fp-math", "true");
+    }
+    if (fastMath.isFast())
+    {
+        function.addFnAttr("unsafe-fp-math", "true");
+    }
+}
+
+namespace
+{
+/// Integers narrower than a register are passed and returned extended to a full register in the C calling
+/// convention. Marking them as such makes functions callable from, and able to call, C and C++.
+void addExtensionAttributes(llvm::Function& function, const Function& source)
 {
+    auto extension = [](Type type)
+    {
+        switch (type)
+        {
+            case Type::Bool: return llvm::Attribute::ZExt;
+            case Type::Int8:
+            case Type::Int16: return llvm::Attribute::SExt;
+            default: return llvm::Attribute::None;
+        }
+    };
+    if (auto kind = extension(source.returnType); kind != llvm::Attribute::None)
+    {
+        function.addRetAttr(kind);
+    }
+    for (std::size_t i = 0; i < source.parameters.size(); i++)
+    {
+        if (auto kind = extension(source.parameters[i]->type); kind != llvm::Attribute::None)
+        {
+            function.addParamAttr(i, kind);
+        }
+    }
+}
+
+} // namespace
+
+llvm::Function* Codegen::declare(const Function& function)
+{
+    if (m_functions.size() <= function.index)
+    {
+        m_functions.resize(function.index + 1);
+    }
+    if (m_functions[function.index])
+    {
+        return m_functions[function.index];
+    }
     auto returnType = visit(function.returnType);
+    if (auto intrinsic = function.external ? mathIntrinsic(function) : std::nullopt)
+    {
+        m_functions[function.index] = llvm::Intrinsic::getDeclaration(m_module.get(), *intrinsic, {returnType});
+        return m_functions[function.index];
+    }
     std::vector<llvm::Type*> argumentTypes;
     for (auto& iter : function.parameters)
     {
         argumentTypes.push_back(visit(iter->type));
     }
     auto* functionType = llvm::FunctionType::get(returnType, argumentTypes, false);
-    m_currentFunc = llvm::Function::Create(functionType, llvm::GlobalValue::ExternalLinkage, 0, function.identifier,
-                                           m_module.get());
-    m_functionMap[&function] = m_currentFunc;
+    auto* result = llvm::Function::Create(functionType, llvm::GlobalValue::ExternalLinkage, 0, function.identifier,
+                                          m_module.get());
+    result->addFnAttr(llvm::Attribute::NoUnwind);
+    addExtensionAttributes(*result, function);
+    m_functions[function.index] = result;
+    if (function.external)
+    {
+        return result;
+    }
+    // Hidden functions are known to be defined within the link, so calls to them need not go through the PLT.
+    if (!function.exported)
+    {
+        result->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+
+    // SimpleC has neither exceptions nor uninitialized values. Everything else depends on the body and callees, as
+    // well as on the instrumentation, which writes to the counters.
+    addTargetAttributes(*result);
+    const auto& properties = m_analysis.get(function);
+    if (properties.noMemoryEffects && !m_options.instrument)
+    {
+        result->addFnAttr(llvm::Attribute::ReadNone);
+        result->addFnAttr(llvm::Attribute::NoFree);
+        result->addFnAttr(llvm::Attribute::NoSync);
+    }
+    if (properties.noRecurse)
+    {
+        result->addFnAttr(llvm::Attribute::NoRecurse);
+    }
+    if (properties.willReturn)
+    {
+        result->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    result->addRetAttr(llvm::Attribute::NoUndef);
+    for (auto& iter : result->args())
+    {
+        iter.addAttr(llvm::Attribute::NoUndef);
+    }
+    return result;
+}
+
+void Codegen::visit(const Function& function)
+{
+    m_analysis.analyze(function);
+    if (function.external)
+    {
+        declare(function);
+        return;
+    }
+    m_currentFunc = declare(function);
+    addSubprogram(*m_currentFunc, function.identifier, function.line);
+    m_builder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+    m_variables.assign(function.slotCount, nullptr);
     m_builder.SetInsertPoint(llvm::BasicBlock::Create(m_module->getContext(), "entry", m_currentFunc));
     for (std::size_t i = 0; i < function.parameters.size(); i++)
     {
         auto* alloca = m_builder.CreateAlloca(visit(function.parameters[i]->type));
-        m_variableMap[function.parameters[i].get()] = alloca;
+        m_variables[function.parameters[i]->slot] = alloca;
         m_builder.CreateStore(m_currentFunc->getArg(i), alloca);
     }
+    m_instrumentation.reset();
+    if (m_options.instrument)
+    {
+        beginInstrumentation(function);
+    }
+    const auto& properties = m_analysis.get(function);
+    m_accumulator = nullptr;
+    if (properties.accumulator)
+    {
+        m_accumulator = m_builder.CreateAlloca(visit(function.returnType));
+        m_accumulatorOperation = *properties.accumulator;
+        m_builder.CreateStore(llvm::ConstantInt::get(m_accumulator->getAllocatedType(),
+                                                     m_accumulatorOperation == Token::Plus ? 0 : 1),
+                              m_accumulator);
+    }
+    m_recursionEntry = nullptr;
+    if (!properties.noRecurse)
+    {
+        m_recursionEntry = llvm::BasicBlock::Create(m_module->getContext(), "recurse", m_currentFunc);
+        m_builder.CreateBr(m_recursionEntry);
+        m_builder.SetInsertPoint(m_recursionEntry);
+    }
     for (auto& iter : function.body)
     {
         visit(iter);
@@ -45,10 +277,206 @@ void Codegen::visit(const Function& function)
     {
         m_builder.CreateUnreachable();
     }
+    if (m_options.batchEntryPoints)
+    {
+        emitBatchEntryPoint(function);
+    }
+    if (m_targetMachine && m_targetMachine->getTargetTriple().getArch() == llvm::Triple::x86_64
+        && std::find(m_options.multiversion.begin(), m_options.multiversion.end(), function.identifier)
+               != m_options.multiversion.end())
+    {
+        emitVersions(function);
+    }
+}
+
+void Codegen::emitVersions(const Function& function)
+{
+    auto& context = m_module->getContext();
+    if (!m_versionSelector)
+    {
+        m_versionSelector = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(context), false),
+                                                   llvm::GlobalValue::InternalLinkage, "simplec.select_versions",
+                                                   m_module.get());
+        addTargetAttributes(*m_versionSelector);
+        m_versionSelector->addFnAttr(llvm::Attribute::NoUnwind);
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", m_versionSelector));
+        auto level = m_module->getOrInsertFunction("simplec_cpu_level", builder.getInt32Ty());
+        if (auto* runtime = llvm::dyn_cast<llvm::Function>(level.getCallee()))
+        {
+            runtime->addFnAttr(llvm::Attribute::NoUnwind);
+        }
+        m_cpuLevel = builder.CreateCall(level);
+        builder.CreateRetVoid();
+        llvm::appendToGlobalCtors(*m_module, m_versionSelector, 0);
+    }
+
+    std::vector<unsigned> levels = m_options.versionLevels;
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+    // Level 1 is the baseline every x86-64 CPU supports.
+    levels.insert(levels.begin(), 1);
+
+    std::vector<llvm::Function*> originals{m_functions[function.index]};
+    if (m_options.batchEntryPoints)
+    {
+        originals.push_back(m_module->getFunction(function.identifier + ".batch"));
+    }
+    llvm::IRBuilder<> selector(m_versionSelector->getEntryBlock().getTerminator());
+    for (auto* original : originals)
+    {
+        llvm::Value* selected = nullptr;
+        for (auto level : levels)
+        {
+            std::string suffix = level == 1 ? ".default" : ".x86-64-v" + std::to_string(level);
+            auto* version = llvm::Function::Create(original->getFunctionType(), llvm::GlobalValue::InternalLinkage,
+                                                   original->getName() + suffix, m_module.get());
+            llvm::ValueToValueMapTy map;
+            auto* argument = version->arg_begin();
+            for (auto& iter : original->args())
+            {
+                map[&iter] = argument++;
+            }
+            // Recursion stays within the version, and versions of the batch entry point call the version of the
+            // function of the same level, which the optimizer inlines.
+            map[original] = version;
+            for (std::size_t i = 0; i < originals.size() && originals[i] != original; i++)
+            {
+                map[originals[i]] = m_module->getFunction((originals[i]->getName() + suffix).str());
+            }
+            llvm::SmallVector<llvm::ReturnInst*> returns;
+            llvm::CloneFunctionInto(version, original, map, llvm::CloneFunctionChangeType::GlobalChanges, returns);
+            if (level != 1)
+            {
+                version->addFnAttr("target-cpu", "x86-64-v" + std::to_string(level));
+            }
+            selected = selected ? selector.CreateSelect(selector.CreateICmpUGE(m_cpuLevel, selector.getInt32(level)),
+                                                        version, selected)
+                                : version;
+        }
+
+        auto linkage = original->getLinkage();
+        original->deleteBody();
+        original->setLinkage(linkage);
+        auto* pointer = new llvm::GlobalVariable(*m_module, original->getType(), false,
+                                                 llvm::GlobalValue::InternalLinkage,
+                                                 m_module->getFunction((original->getName() + ".default").str()),
+                                                 original->getName() + ".version");
+        selector.CreateStore(selected, pointer);
+
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", original));
+        auto* load = builder.CreateLoad(original->getType(), pointer);
+        load->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(context, {}));
+        std::vector<llvm::Value*> arguments;
+        for (auto& iter : original->args())
+        {
+            arguments.push_back(&iter);
+        }
+        auto* call = builder.CreateCall(original->getFunctionType(), load, arguments);
+        // Sign and zero extension of parameters are part of the ABI, which must match for 'musttail'.
+        const auto& attributes = original->getAttributes();
+        llvm::SmallVector<llvm::AttributeSet> parameterAttributes;
+        for (std::size_t i = 0; i < original->arg_size(); i++)
+        {
+            parameterAttributes.push_back(attributes.getParamAttrs(i));
+        }
+        call->setAttributes(llvm::AttributeList::get(context, {}, attributes.getRetAttrs(), parameterAttributes));
+        call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+        if (original->getReturnType()->isVoidTy())
+        {
+            builder.CreateRetVoid();
+        }
+        else
+        {
+            builder.CreateRet(call);
+        }
+    }
+}
+
+void Codegen::emitBatchEntryPoint(const Function& function)
+{
+    auto& context = m_module->getContext();
+    auto* int64Type = llvm::Type::getInt64Ty(context);
+    auto* scalar = m_functions[function.index];
+    // 'bool' is an 'i1' in registers but a whole byte in memory.
+    auto memoryType = [&](Type type) -> llvm::Type*
+    {
+        return type == Type::Bool ? llvm::Type::getInt8Ty(context) : visit(type);
+    };
+
+    std::vector<llvm::Type*> argumentTypes;
+    for (auto& iter : function.parameters)
+    {
+        argumentTypes.push_back(memoryType(iter->type)->getPointerTo());
+    }
+    argumentTypes.push_back(memoryType(function.returnType)->getPointerTo());
+    argumentTypes.push_back(int64Type);
+    auto* batch = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(context), argumentTypes, false),
+                                         llvm::GlobalValue::ExternalLinkage, 0, function.identifier + ".batch",
+                                         m_module.get());
+    batch->setVisibility(declare(function)->getVisibility());
+    addTargetAttributes(*batch);
+    batch->addFnAttr(llvm::Attribute::NoUnwind);
+    const auto& properties = m_analysis.get(function);
+    if (properties.noMemoryEffects && !m_options.instrument)
+    {
+        batch->addFnAttr(llvm::Attribute::NoFree);
+        batch->addFnAttr(llvm::Attribute::NoSync);
+    }
+    if (properties.willReturn)
+    {
+        batch->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    for (std::size_t i = 0; i < argumentTypes.size() - 1; i++)
+    {
+        batch->addParamAttr(i, llvm::Attribute::NoAlias);
+        batch->addParamAttr(i, llvm::Attribute::NoCapture);
+        batch->addParamAttr(i, i < function.parameters.size() ? llvm::Attribute::ReadOnly : llvm::Attribute::WriteOnly);
+    }
+    auto* count = batch->getArg(argumentTypes.size() - 1);
+
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", batch));
+    builder.setFastMathFlags(m_options.fastMath);
+    auto* loopBlock = llvm::BasicBlock::Create(context, "", batch);
+    auto* exitBlock = llvm::BasicBlock::Create(context, "", batch);
+    builder.CreateCondBr(builder.CreateICmpSGT(count, llvm::ConstantInt::get(int64Type, 0)), loopBlock, exitBlock);
+
+    builder.SetInsertPoint(loopBlock);
+    auto* index = builder.CreatePHI(int64Type, 2);
+    index->addIncoming(llvm::ConstantInt::get(int64Type, 0), &batch->getEntryBlock());
+    std::vector<llvm::Value*> arguments;
+    for (std::size_t i = 0; i < function.parameters.size(); i++)
+    {
+        auto* elementType = memoryType(function.parameters[i]->type);
+        llvm::Value* element = builder.CreateLoad(elementType, builder.CreateGEP(elementType, batch->getArg(i), index));
+        if (function.parameters[i]->type == Type::Bool)
+        {
+            element = builder.CreateTrunc(element, builder.getInt1Ty());
+        }
+        arguments.push_back(element);
+    }
+    auto* call = builder.CreateCall(scalar->getFunctionType(), scalar, arguments);
+    call->addFnAttr(llvm::Attribute::AlwaysInline);
+    auto* resultType = memoryType(function.returnType);
+    llvm::Value* result = call;
+    if (function.returnType == Type::Bool)
+    {
+        result = builder.CreateZExt(result, resultType);
+    }
+    builder.CreateStore(result, builder.CreateGEP(resultType, batch->getArg(function.parameters.size()), index));
+    auto* next = builder.CreateNSWAdd(index, llvm::ConstantInt::get(int64Type, 1));
+    index->addIncoming(next, loopBlock);
+    builder.CreateCondBr(builder.CreateICmpEQ(next, count), exitBlock, loopBlock);
+
+    builder.SetInsertPoint(exitBlock);
+    builder.CreateRetVoid();
 }
 
 llvm::Value* Codegen::boolean(llvm::Value* value)
 {
+    if (value->getType()->isIntegerTy(1))
+    {
+        return value;
+    }
     if (value->getType()->isIntegerTy())
     {
         return m_builder.CreateCmp(llvm::CmpInst::ICMP_NE, value, llvm::ConstantInt::get(value->getType(), 0));
@@ -56,12 +484,186 @@ llvm::Value* Codegen::boolean(llvm::Value* value)
     return m_builder.CreateFCmp(llvm::CmpInst::FCMP_UNE, value, llvm::ConstantFP::get(value->getType(), 0));
 }
 
+namespace
+{
+/// Branch weights of a condition of the given likelihood, or null if it is unknown. The weights are those clang uses
+/// for '__builtin_expect'.
+llvm::MDNode* branchWeights(llvm::LLVMContext& context, Likelihood likelihood)
+{
+    switch (likelihood)
+    {
+        case Likelihood::Unknown: return nullptr;
+        case Likelihood::Likely: return llvm::MDBuilder(context).createBranchWeights(2000, 1);
+        case Likelihood::Unlikely: return llvm::MDBuilder(context).createBranchWeights(1, 2000);
+    }
+    __builtin_unreachable();
+}
+
+/// The 'llvm.loop' metadata requesting 'hints', or null if there are none. It belongs on the back edge of the loop.
+llvm::MDNode* loopMetadata(llvm::LLVMContext& context, const LoopHints& hints)
+{
+    if (hints.empty())
+    {
+        return nullptr;
+    }
+    // The first operand refers to the node itself, which keeps nodes of different loops distinct.
+    llvm::SmallVector<llvm::Metadata*, 4> operands{nullptr};
+    auto option = [&](llvm::StringRef name, std::optional<unsigned> value = std::nullopt)
+    {
+        llvm::SmallVector<llvm::Metadata*, 2> entry{llvm::MDString::get(context, name)};
+        if (value)
+        {
+            entry.push_back(llvm::ConstantAsMetadata::get(
+                llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), *value)));
+        }
+        operands.push_back(llvm::MDNode::get(context, entry));
+    };
+    if (hints.unrollCount == 1)
+    {
+        option("llvm.loop.unroll.disable");
+    }
+    else if (hints.unrollCount != 0)
+    {
+        option("llvm.loop.unroll.count", hints.unrollCount);
+    }
+    else if (hints.unroll)
+    {
+        option("llvm.loop.unroll.full");
+    }
+    if (hints.vectorize)
+    {
+        operands.push_back(llvm::MDNode::get(
+            context, {llvm::MDString::get(context, "llvm.loop.vectorize.enable"),
+                      llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(context))}));
+        if (hints.vectorizeWidth != 0)
+        {
+            option("llvm.loop.vectorize.width", hints.vectorizeWidth);
+        }
+        if (hints.interleaveCount != 0)
+        {
+            option("llvm.loop.interleave.count", hints.interleaveCount);
+        }
+    }
+    auto* loop = llvm::MDNode::getDistinct(context, operands);
+    loop->replaceOperandWith(0, loop);
+    return loop;
+}
+
+} // namespace
+
+llvm::Value* Codegen::convert(llvm::Value* value, Type from, Type to)
+{
+    if (isVector(to) && !isVector(from))
+    {
+        return m_builder.CreateVectorSplat(laneCount(to), convert(value, from, elementType(to)));
+    }
+    if (from == to)
+    {
+        return value;
+    }
+    llvm::Type* type = visit(to);
+    if (to == Type::Bool)
+    {
+        return boolean(value);
+    }
+    // 'bool' converts to 1 or 0, never to -1.
+    bool isSigned = from != Type::Bool;
+    if (isFloatingPoint(to))
+    {
+        if (isFloatingPoint(from))
+        {
+            return m_builder.CreateFPCast(value, type);
+        }
+        return isSigned ? m_builder.CreateSIToFP(value, type) : m_builder.CreateUIToFP(value, type);
+    }
+    if (isFloatingPoint(from))
+    {
+        return m_builder.CreateFPToSI(value, type);
+    }
+    return m_builder.CreateIntCast(value, type, isSigned);
+}
+
+void Codegen::emitReturn(const Expression& expression)
+{
+    auto isSelfCall = [&](const Expression& operand) -> const CallExpression*
+    {
+        auto* call = dynamic_cast<const CallExpression*>(&operand);
+        return call && m_recursionEntry && declare(*call->function) == m_currentFunc ? call : nullptr;
+    };
+    if (auto* call = isSelfCall(expression))
+    {
+        emitSelfTailCall(*call, nullptr);
+        return;
+    }
+    auto* binary = dynamic_cast<const BinaryExpression*>(&expression);
+    if (m_accumulator && binary && binary->operation == m_accumulatorOperation)
+    {
+        if (auto* call = isSelfCall(*binary->lhs))
+        {
+            emitSelfTailCall(*call, binary->rhs.get());
+            return;
+        }
+        if (auto* call = isSelfCall(*binary->rhs))
+        {
+            emitSelfTailCall(*call, binary->lhs.get());
+            return;
+        }
+    }
+
+    llvm::Value* value = visit(expression);
+    if (m_accumulator)
+    {
+        llvm::Value* accumulator = m_builder.CreateLoad(m_accumulator->getAllocatedType(), m_accumulator);
+        value = m_accumulatorOperation == Token::Plus ? m_builder.CreateAdd(accumulator, value)
+                                                      : m_builder.CreateMul(accumulator, value);
+    }
+    // A call returned as is may reuse the stack frame of the caller, which is guaranteed if both have the same
+    // signature and nothing else happens in between.
+    else if (auto* call = llvm::dyn_cast<llvm::CallInst>(value);
+             call && dynamic_cast<const CallExpression*>(&expression) && !call->getCalledFunction()->isIntrinsic())
+    {
+        bool sameSignature = call->getFunctionType() == m_currentFunc->getFunctionType()
+                             && call->getCalledFunction()->getAttributes().getRetAttrs()
+                                    == m_currentFunc->getAttributes().getRetAttrs();
+        call->setTailCallKind(sameSignature && !m_instrumentation ? llvm::CallInst::TCK_MustTail
+                                                                  : llvm::CallInst::TCK_Tail);
+    }
+    endInstrumentation();
+    m_builder.CreateRet(value);
+}
+
+void Codegen::emitSelfTailCall(const CallExpression& call, const Expression* operand)
+{
+    std::vector<llvm::Value*> arguments;
+    for (auto& iter : call.arguments)
+    {
+        arguments.push_back(visit(*iter));
+    }
+    if (operand)
+    {
+        llvm::Value* value = visit(*operand);
+        llvm::Value* accumulator = m_builder.CreateLoad(m_accumulator->getAllocatedType(), m_accumulator);
+        m_builder.CreateStore(m_accumulatorOperation == Token::Plus ? m_builder.CreateAdd(accumulator, value)
+                                                                    : m_builder.CreateMul(accumulator, value),
+                              m_accumulator);
+    }
+    for (std::size_t i = 0; i < arguments.size(); i++)
+    {
+        m_builder.CreateStore(arguments[i], m_variables[call.function->parameters[i]->slot]);
+    }
+    m_builder.CreateBr(m_recursionEntry);
+}
+
 void Codegen::visit(const Statement& statement)
 {
+    if (auto* subprogram = m_currentFunc->getSubprogram())
+    {
+        m_builder.SetCurrentDebugLocation(
+            llvm::DILocation::get(m_module->getContext(), statement.line, 0, subprogram));
+    }
     if (auto* ret = std::get_if<Statement::ReturnStatement>(&statement.variant))
     {
-        llvm::Value* value = visit(*ret->expression);
-        m_builder.CreateRet(value);
+        emitReturn(*ret->expression);
         m_builder.ClearInsertionPoint();
         return;
     }
@@ -72,22 +674,25 @@ void Codegen::visit(const Statement& statement)
     }
     if (auto* varDecl = std::get_if<std::unique_ptr<VarDecl>>(&statement.variant))
     {
-        llvm::IRBuilder<> temp(&m_currentFunc->getEntryBlock());
+        auto& entry = m_currentFunc->getEntryBlock();
+        llvm::IRBuilder<> temp(&entry, entry.begin());
         auto* alloca = temp.CreateAlloca(visit((*varDecl)->type));
+        // Variables without initializer start out as zero. This keeps all values well defined, which allows
+        // parameters and return values to be 'noundef'.
+        llvm::Value* value = llvm::Constant::getNullValue(alloca->getAllocatedType());
         if ((*varDecl)->initializer)
         {
-            llvm::Value* value = visit(*(*varDecl)->initializer);
-            m_builder.CreateStore(value, alloca);
+            value = visit(*(*varDecl)->initializer);
         }
-        m_variableMap[varDecl->get()] = alloca;
+        m_builder.CreateStore(value, alloca);
+        m_variables[(*varDecl)->slot] = alloca;
         return;
     }
     if (auto* assignment = std::get_if<Statement::Assignment>(&statement.variant))
     {
         llvm::Value* value = visit(*assignment->value);
-        auto result = m_variableMap.find(assignment->variable);
-        assert(result != m_variableMap.end());
-        m_builder.CreateStore(value, result->second);
+        assert(m_variables[assignment->variable->slot]);
+        m_builder.CreateStore(value, m_variables[assignment->variable->slot]);
         return;
     }
     if (auto* ifStmt = std::get_if<Statement::IfStatement>(&statement.variant))
@@ -95,7 +700,8 @@ void Codegen::visit(const Statement& statement)
         auto trueBranch = llvm::BasicBlock::Create(m_module->getContext());
         auto continueBranch = llvm::BasicBlock::Create(m_module->getContext());
         llvm::Value* condition = boolean(visit(*ifStmt->condition));
-        m_builder.CreateCondBr(condition, trueBranch, continueBranch);
+        m_builder.CreateCondBr(condition, trueBranch, continueBranch,
+                               branchWeights(m_module->getContext(), ifStmt->likelihood));
 
         trueBranch->insertInto(m_currentFunc);
         m_builder.SetInsertPoint(trueBranch);
@@ -121,7 +727,8 @@ void Codegen::visit(const Statement& statement)
         auto body = llvm::BasicBlock::Create(m_module->getContext());
         auto continueBranch = llvm::BasicBlock::Create(m_module->getContext());
         llvm::Value* condition = boolean(visit(*whileStmt->condition));
-        m_builder.CreateCondBr(condition, body, continueBranch);
+        m_builder.CreateCondBr(condition, body, continueBranch,
+                               branchWeights(m_module->getContext(), whileStmt->likelihood));
 
         body->insertInto(m_currentFunc);
         m_builder.SetInsertPoint(body);
@@ -131,49 +738,329 @@ void Codegen::visit(const Statement& statement)
         }
         if (m_builder.GetInsertBlock() && !m_builder.GetInsertBlock()->getTerminator())
         {
-            m_builder.CreateBr(conditionBlock);
+            countIterations(m_builder.getInt64(1));
+            auto* backEdge = m_builder.CreateBr(conditionBlock);
+            if (auto* metadata = loopMetadata(m_module->getContext(), whileStmt->hints))
+            {
+                backEdge->setMetadata(llvm::LLVMContext::MD_loop, metadata);
+            }
         }
 
         continueBranch->insertInto(m_currentFunc);
         m_builder.SetInsertPoint(continueBranch);
         return;
     }
+    if (auto* parallelFor = std::get_if<Statement::ParallelFor>(&statement.variant))
+    {
+        visit(*parallelFor);
+        return;
+    }
 }
 
+void Codegen::visit(const Statement::ParallelFor& loop)
+{
+    auto& context = m_module->getContext();
+    auto* int64Type = llvm::Type::getInt64Ty(context);
+    auto* bytePointerType = llvm::Type::getInt8PtrTy(context);
+
+    llvm::Value* begin = m_builder.CreateIntCast(visit(*loop.begin), int64Type, true);
+    llvm::Value* end = m_builder.CreateIntCast(visit(*loop.end), int64Type, true);
+
+    // Captured variables are passed by value, reduction variables by address.
+    std::vector<llvm::Type*> fieldTypes;
+    for (auto* iter : loop.captures)
+    {
+        fieldTypes.push_back(visit(iter->type));
+    }
+    for (auto& iter : loop.reductions)
+    {
+        fieldTypes.push_back(m_variables[iter.variable->slot]->getType());
+    }
+    auto* closureType = llvm::StructType::get(context, fieldTypes);
+    auto& entry = m_currentFunc->getEntryBlock();
+    auto* closure = llvm::IRBuilder<>(&entry, entry.begin()).CreateAlloca(closureType);
+    for (std::size_t i = 0; i < loop.captures.size(); i++)
+    {
+        auto* variable = m_variables[loop.captures[i]->slot];
+        m_builder.CreateStore(m_builder.CreateLoad(variable->getAllocatedType(), variable),
+                              m_builder.CreateStructGEP(closureType, closure, i));
+    }
+    for (std::size_t i = 0; i < loop.reductions.size(); i++)
+    {
+        m_builder.CreateStore(m_variables[loop.reductions[i].variable->slot],
+                              m_builder.CreateStructGEP(closureType, closure, loop.captures.size() + i));
+    }
+
+    auto* bodyType =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context), {int64Type, int64Type, bytePointerType}, false);
+    auto* body = llvm::Function::Create(bodyType, llvm::GlobalValue::InternalLinkage,
+                                        m_currentFunc->getName() + ".parallel", m_module.get());
+    addTargetAttributes(*body);
+    body->addFnAttr(llvm::Attribute::NoUnwind);
+    auto debugLocation = m_builder.getCurrentDebugLocation();
+    addSubprogram(*body, body->getName(), debugLocation ? debugLocation.getLine() : 0);
+
+    // Iterations of the outlined body are counted as a whole by the caller.
+    auto* parent = m_currentFunc;
+    auto insertPoint = m_builder.saveIP();
+    auto parentVariables = m_variables;
+    auto parentInstrumentation = std::exchange(m_instrumentation, std::nullopt);
+    m_builder.SetCurrentDebugLocation(llvm::DebugLoc());
+    m_currentFunc = body;
+    m_builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", body));
+
+    auto* closureArg = m_builder.CreateBitCast(body->getArg(2), closureType->getPointerTo());
+    for (std::size_t i = 0; i < loop.captures.size(); i++)
+    {
+        auto* type = fieldTypes[i];
+        auto* alloca = m_builder.CreateAlloca(type);
+        m_builder.CreateStore(m_builder.CreateLoad(type, m_builder.CreateStructGEP(closureType, closureArg, i)), alloca);
+        m_variables[loop.captures[i]->slot] = alloca;
+    }
+    for (auto& iter : loop.reductions)
+    {
+        auto* type = visit(iter.variable->type);
+        auto* alloca = m_builder.CreateAlloca(type);
+        llvm::Value* identity = llvm::Constant::getNullValue(type);
+        if (iter.operation == Token::Times)
+        {
+            identity = type->isFloatingPointTy() ? llvm::ConstantFP::get(type, 1.0) : llvm::ConstantInt::get(type, 1);
+        }
+        m_builder.CreateStore(identity, alloca);
+        m_variables[iter.variable->slot] = alloca;
+    }
+    auto* induction = m_builder.CreateAlloca(visit(loop.induction->type));
+    m_variables[loop.induction->slot] = induction;
+    auto* counter = m_builder.CreateAlloca(int64Type);
+    m_builder.CreateStore(body->getArg(0), counter);
+
+    auto* conditionBlock = llvm::BasicBlock::Create(context, "", body);
+    auto* bodyBlock = llvm::BasicBlock::Create(context, "", body);
+    auto* exitBlock = llvm::BasicBlock::Create(context, "", body);
+    m_builder.CreateBr(conditionBlock);
+    m_builder.SetInsertPoint(conditionBlock);
+    llvm::Value* index = m_builder.CreateLoad(int64Type, counter);
+    m_builder.CreateCondBr(m_builder.CreateICmpSLT(index, body->getArg(1)), bodyBlock, exitBlock);
+
+    m_builder.SetInsertPoint(bodyBlock);
+    m_builder.CreateStore(m_builder.CreateIntCast(index, induction->getAllocatedType(), true), induction);
+    for (auto& iter : loop.body)
+    {
+        visit(iter);
+    }
+    m_builder.CreateStore(m_builder.CreateNSWAdd(index, llvm::ConstantInt::get(int64Type, 1)), counter);
+    m_builder.CreateBr(conditionBlock);
+
+    m_builder.SetInsertPoint(exitBlock);
+    for (std::size_t i = 0; i < loop.reductions.size(); i++)
+    {
+        auto& reduction = loop.reductions[i];
+        auto* partial = m_variables[reduction.variable->slot];
+        auto* shared = m_builder.CreateLoad(fieldTypes[loop.captures.size() + i],
+                                            m_builder.CreateStructGEP(closureType, closureArg, loop.captures.size() + i));
+        emitAtomicReduction(reduction.operation, reduction.variable->type, shared,
+                            m_builder.CreateLoad(partial->getAllocatedType(), partial));
+    }
+    m_builder.CreateRetVoid();
+
+    m_currentFunc = parent;
+    m_builder.restoreIP(insertPoint);
+    m_builder.SetCurrentDebugLocation(debugLocation);
+    m_variables = std::move(parentVariables);
+    m_instrumentation = parentInstrumentation;
+
+    auto runtime = m_module->getOrInsertFunction(
+        "simplec_parallel_for", llvm::Type::getVoidTy(context), int64Type, int64Type, bodyType->getPointerTo(),
+        bytePointerType);
+    if (auto* function = llvm::dyn_cast<llvm::Function>(runtime.getCallee()))
+    {
+        function->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+    m_builder.CreateCall(runtime, {begin, end, body, m_builder.CreateBitCast(closure, bytePointerType)});
+    if (m_instrumentation)
+    {
+        auto* count = m_builder.CreateSub(end, begin);
+        countIterations(m_builder.CreateSelect(m_builder.CreateICmpSGT(count, m_builder.getInt64(0)), count,
+                                               m_builder.getInt64(0)));
+    }
+}
+
+void Codegen::beginInstrumentation(const Function& function)
+{
+    auto& context = m_module->getContext();
+    auto* int64Type = llvm::Type::getInt64Ty(context);
+    // The runtime assigns every function an index into the counter tables the first time it is entered and stores it
+    // in 'id', after which finding the counters of the current thread is only a few loads.
+    auto* id = new llvm::GlobalVariable(*m_module, int64Type, false, llvm::GlobalValue::PrivateLinkage,
+                                        llvm::ConstantInt::get(int64Type, -1, true),
+                                        m_currentFunc->getName() + ".profile");
+    auto* name = m_builder.CreateGlobalStringPtr(function.identifier, m_currentFunc->getName() + ".name");
+    auto enter = m_module->getOrInsertFunction("simplec_profile_enter", int64Type->getPointerTo(),
+                                               int64Type->getPointerTo(), name->getType());
+    if (auto* runtime = llvm::dyn_cast<llvm::Function>(enter.getCallee()))
+    {
+        runtime->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+
+    Instrumentation instrumentation{};
+    instrumentation.counters = m_builder.CreateCall(enter, {id, name});
+    instrumentation.iterations = m_builder.CreateAlloca(int64Type);
+    m_builder.CreateStore(m_builder.getInt64(0), instrumentation.iterations);
+    if (m_options.instrumentCycles)
+    {
+        instrumentation.startCycles = m_builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {});
+    }
+    m_instrumentation = instrumentation;
+}
+
+void Codegen::countIterations(llvm::Value* count)
+{
+    if (!m_instrumentation)
+    {
+        return;
+    }
+    auto* iterations = m_instrumentation->iterations;
+    m_builder.CreateStore(m_builder.CreateAdd(m_builder.CreateLoad(m_builder.getInt64Ty(), iterations), count),
+                          iterations);
+}
+
+void Codegen::endInstrumentation()
+{
+    if (!m_instrumentation)
+    {
+        return;
+    }
+    auto* int64Type = m_builder.getInt64Ty();
+    auto add = [&](unsigned counter, llvm::Value* value)
+    {
+        auto* pointer = m_builder.CreateConstInBoundsGEP1_64(int64Type, m_instrumentation->counters, counter);
+        m_builder.CreateStore(m_builder.CreateAdd(m_builder.CreateLoad(int64Type, pointer), value), pointer);
+    };
+    add(0, m_builder.getInt64(1));
+    add(1, m_builder.CreateLoad(int64Type, m_instrumentation->iterations));
+    if (m_instrumentation->startCycles)
+    {
+        add(2, m_builder.CreateSub(m_builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {}),
+                                   m_instrumentation->startCycles));
+    }
+}
+
+void Codegen::emitAtomicReduction(Token::TokenType operation, Type type, llvm::Value* pointer, llvm::Value* value)
+{
+    // The runtime synchronizes with the end of every chunk before returning, so there is no need for anything stronger
+    // than monotonic ordering.
+    constexpr auto ordering = llvm::AtomicOrdering::Monotonic;
+    if (operation == Token::Plus)
+    {
+        m_builder.CreateAtomicRMW(isFloatingPoint(type) ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add,
+                                  pointer, value, llvm::MaybeAlign(), ordering);
+        return;
+    }
+
+    // There is no atomic multiplication, use a compare exchange loop instead. 'cmpxchg' only operates on integers.
+    auto* valueType = value->getType();
+    auto* bitsType = m_builder.getIntNTy(valueType->getPrimitiveSizeInBits());
+    auto* bitsPointer = m_builder.CreateBitCast(pointer, bitsType->getPointerTo());
+    auto* initial = m_builder.CreateLoad(bitsType, bitsPointer);
+    initial->setAtomic(ordering);
+    auto* preheader = m_builder.GetInsertBlock();
+    auto* loopBlock = llvm::BasicBlock::Create(m_module->getContext(), "", m_currentFunc);
+    auto* exitBlock = llvm::BasicBlock::Create(m_module->getContext(), "", m_currentFunc);
+    m_builder.CreateBr(loopBlock);
+
+    m_builder.SetInsertPoint(loopBlock);
+    auto* expected = m_builder.CreatePHI(bitsType, 2);
+    expected->addIncoming(initial, preheader);
+    llvm::Value* desired;
+    if (isFloatingPoint(type))
+    {
+        desired = m_builder.CreateBitCast(
+            m_builder.CreateFMul(m_builder.CreateBitCast(expected, valueType), value), bitsType);
+    }
+    else
+    {
+        desired = m_builder.CreateMul(expected, value);
+    }
+    auto* exchange = m_builder.CreateAtomicCmpXchg(bitsPointer, expected, desired, llvm::MaybeAlign(), ordering,
+                                                   ordering);
+    expected->addIncoming(m_builder.CreateExtractValue(exchange, 0), loopBlock);
+    m_builder.CreateCondBr(m_builder.CreateExtractValue(exchange, 1), exitBlock, loopBlock);
+
+    m_builder.SetInsertPoint(exitBlock);
+}
+
+namespace
+{
+llvm::SmallVector<const Expression*, 2> operandsOf(const Expression& expression)
+{
+    llvm::SmallVector<const Expression*, 2> result;
+    forEachOperand(expression, [&](const Expression& operand) { result.push_back(&operand); });
+    return result;
+}
+
+} // namespace
+
 llvm::Value* Codegen::visit(const Expression& expression)
+{
+    struct Frame
+    {
+        const Expression* expression;
+        bool operandsLowered;
+    };
+    std::vector<Frame> work{{&expression, false}};
+    std::vector<llvm::Value*> values;
+    while (!work.empty())
+    {
+        auto [current, operandsLowered] = work.back();
+        work.pop_back();
+        auto operands = operandsOf(*current);
+        if (!operandsLowered && !operands.empty())
+        {
+            // Operands are pushed in reverse so that they are lowered, and their values end up on 'values', from
+            // left to right.
+            work.push_back({current, true});
+            for (auto iter = operands.rbegin(); iter != operands.rend(); iter++)
+            {
+                work.push_back({*iter, false});
+            }
+            continue;
+        }
+        std::size_t firstOperand = values.size() - operands.size();
+        llvm::Value* result = emit(*current, llvm::makeArrayRef(values).drop_front(firstOperand));
+        values.resize(firstOperand);
+        values.push_back(result);
+    }
+    return values.back();
+}
+
+llvm::Value* Codegen::emit(const Expression& expression, llvm::ArrayRef<llvm::Value*> operands)
 {
     if (auto* atom = dynamic_cast<const Atom*>(&expression))
     {
-        if (const int* integer = std::get_if<int>(&atom->valueOrVar))
+        if (const std::int64_t* integer = std::get_if<std::int64_t>(&atom->valueOrVar))
+        {
+            return llvm::ConstantInt::get(visit(expression.type), *integer, /*IsSigned=*/true);
+        }
+        if (const bool* truthValue = std::get_if<bool>(&atom->valueOrVar))
         {
-            return llvm::ConstantInt::get(visit(expression.type), *integer);
+            return llvm::ConstantInt::getBool(m_module->getContext(), *truthValue);
         }
         if (const double* floating = std::get_if<double>(&atom->valueOrVar))
         {
             return llvm::ConstantFP::get(visit(expression.type), *floating);
         }
         VarDecl* decl = std::get<VarDecl*>(atom->valueOrVar);
-        auto result = m_variableMap.find(decl);
-        assert(result != m_variableMap.end());
-        return m_builder.CreateLoad(visit(decl->type), result->second);
+        assert(m_variables[decl->slot]);
+        return m_builder.CreateLoad(visit(decl->type), m_variables[decl->slot]);
     }
     if (auto* cast = dynamic_cast<const CastExpression*>(&expression))
     {
-        llvm::Value* value = visit(*cast->operand);
-        if (cast->type == Type::Integer && cast->operand->type == Type::Double)
-        {
-            return m_builder.CreateFPToSI(value, visit(cast->type));
-        }
-        if (cast->type == Type::Double && cast->operand->type == Type::Integer)
-        {
-            return m_builder.CreateSIToFP(value, visit(cast->type));
-        }
-        return value;
+        return convert(operands[0], cast->operand->type, cast->type);
     }
     if (auto* negate = dynamic_cast<const NegateExpression*>(&expression))
     {
-        llvm::Value* value = visit(*negate->operand);
-        if (negate->type == Type::Double)
+        llvm::Value* value = operands[0];
+        if (isFloatingPoint(negate->type))
         {
             return m_builder.CreateFNeg(value);
         }
@@ -181,34 +1068,19 @@ llvm::Value* Codegen::visit(const Expression& expression)
     }
     if (auto* call = dynamic_cast<const CallExpression*>(&expression))
     {
-        auto result = m_functionMap.find(call->function);
-        assert(result != m_functionMap.end());
-        std::vector<llvm::Value*> arguments;
-        for (auto& iter : call->arguments)
-        {
-            arguments.push_back(visit(*iter));
-        }
-        return m_builder.CreateCall(result->second, arguments);
+        return m_builder.CreateCall(declare(*call->function), operands);
+    }
+    if (auto* builtin = dynamic_cast<const BuiltinExpression*>(&expression))
+    {
+        return emit(*builtin, operands);
     }
     auto& binary = dynamic_cast<const BinaryExpression&>(expression);
-    llvm::Value* lhs = visit(*binary.lhs);
-    llvm::Value* rhs = visit(*binary.rhs);
+    llvm::Value* lhs = operands[0];
+    llvm::Value* rhs = operands[1];
     switch (binary.operation)
     {
-        case Token::OrKeyword:
-        {
-            lhs = boolean(lhs);
-            rhs = boolean(rhs);
-            auto result = m_builder.CreateOr(lhs, rhs);
-            return m_builder.CreateZExt(result, visit(binary.type));
-        }
-        case Token::AndKeyword:
-        {
-            lhs = boolean(lhs);
-            rhs = boolean(rhs);
-            auto result = m_builder.CreateOr(lhs, rhs);
-            return m_builder.CreateZExt(result, visit(binary.type));
-        }
+        case Token::OrKeyword: return m_builder.CreateOr(lhs, rhs);
+        case Token::AndKeyword: return m_builder.CreateAnd(lhs, rhs);
         case Token::Less:
         case Token::LessEqual:
         case Token::Greater:
@@ -217,7 +1089,20 @@ llvm::Value* Codegen::visit(const Expression& expression)
         case Token::NotEqual:
         {
             llvm::CmpInst::Predicate predicate;
-            if (binary.lhs->type == Type::Integer)
+            if (binary.lhs->type == Type::Bool)
+            {
+                switch (binary.operation)
+                {
+                    case Token::Less: predicate = llvm::CmpInst::ICMP_ULT; break;
+                    case Token::LessEqual: predicate = llvm::CmpInst::ICMP_ULE; break;
+                    case Token::Greater: predicate = llvm::CmpInst::ICMP_UGT; break;
+                    case Token::GreaterEqual: predicate = llvm::CmpInst::ICMP_UGE; break;
+                    case Token::Equal: predicate = llvm::CmpInst::ICMP_EQ; break;
+                    case Token::NotEqual: predicate = llvm::CmpInst::ICMP_NE; break;
+                    default: __builtin_unreachable();
+                }
+            }
+            else if (!isFloatingPoint(binary.lhs->type))
             {
                 switch (binary.operation)
                 {
@@ -243,12 +1128,13 @@ llvm::Value* Codegen::visit(const Expression& expression)
                     default: __builtin_unreachable();
                 }
             }
-            auto cmp = m_builder.CreateCmp(predicate, lhs, rhs);
-            return m_builder.CreateZExt(cmp, visit(binary.type));
+            llvm::Value* result = m_builder.CreateCmp(predicate, lhs, rhs);
+            // Vector comparisons yield 1 or 0 per lane in an 'int' vector.
+            return isVector(binary.type) ? m_builder.CreateZExt(result, visit(binary.type)) : result;
         }
         case Token::Plus:
         {
-            if (binary.type == Type::Integer)
+            if (!isFloatingPoint(binary.type))
             {
                 return m_builder.CreateAdd(lhs, rhs);
             }
@@ -259,7 +1145,7 @@ llvm::Value* Codegen::visit(const Expression& expression)
         }
         case Token::Minus:
         {
-            if (binary.type == Type::Integer)
+            if (!isFloatingPoint(binary.type))
             {
                 return m_builder.CreateSub(lhs, rhs);
             }
@@ -270,7 +1156,7 @@ llvm::Value* Codegen::visit(const Expression& expression)
         }
         case Token::Times:
         {
-            if (binary.type == Type::Integer)
+            if (!isFloatingPoint(binary.type))
             {
                 return m_builder.CreateMul(lhs, rhs);
             }
@@ -281,7 +1167,7 @@ llvm::Value* Codegen::visit(const Expression& expression)
         }
         case Token::Divide:
         {
-            if (binary.type == Type::Integer)
+            if (!isFloatingPoint(binary.type))
             {
                 return m_builder.CreateSDiv(lhs, rhs);
             }
@@ -294,3 +1180,29 @@ llvm::Value* Codegen::visit(const Expression& expression)
     }
     __builtin_unreachable();
 }
+
+llvm::Value* Codegen::emit(const BuiltinExpression& builtin, llvm::ArrayRef<llvm::Value*> operands)
+{
+    Type vectorType = builtin.arguments[0]->type;
+    llvm::Value* vector = operands[0];
+    bool isDouble = isFloatingPoint(vectorType);
+    // Lane counts are powers of two, masking the index makes it wrap around instead of producing poison.
+    auto lane = [&] { return m_builder.CreateAnd(operands[1], laneCount(vectorType) - 1); };
+    switch (builtin.kind)
+    {
+        case BuiltinExpression::Extract: return m_builder.CreateExtractElement(vector, lane());
+        case BuiltinExpression::Insert: return m_builder.CreateInsertElement(vector, operands[2], lane());
+        // Floating point reductions are performed in lane order unless fast-math allows reassociating them.
+        case BuiltinExpression::Sum:
+            return isDouble ? m_builder.CreateFAddReduce(llvm::ConstantFP::getNegativeZero(visit(Type::Double)), vector)
+                            : m_builder.CreateAddReduce(vector);
+        case BuiltinExpression::Product:
+            return isDouble ? m_builder.CreateFMulReduce(llvm::ConstantFP::get(visit(Type::Double), 1.0), vector)
+                            : m_builder.CreateMulReduce(vector);
+        case BuiltinExpression::Min:
+            return isDouble ? m_builder.CreateFPMinReduce(vector) : m_builder.CreateIntMinReduce(vector, true);
+        case BuiltinExpression::Max:
+            return isDouble ? m_builder.CreateFPMaxReduce(vector) : m_builder.CreateIntMaxReduce(vector, true);
+    }
+    __builtin_unreachable();
+}
@@ -1,31 +1,181 @@
 #pragma once
 
+#include <llvm/ADT/Hashing.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
 
-#include <unordered_map>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include "Analysis.hpp"
 #include "Syntax.hpp"
 
+/// Knobs affecting the IR produced by 'Codegen' that are not implied by the source or target.
+struct CodegenOptions
+{
+    /// Fast-math flags attached to every floating point operation.
+    llvm::FastMathFlags fastMath;
+    /// Emit a batch entry point, see 'Codegen::emitBatchEntryPoint', next to every function.
+    bool batchEntryPoints = false;
+    /// Emit debug info mapping instructions to the line of the statement they were generated from, naming the source
+    /// 'sourceFileName'.
+    bool debugInfo = false;
+    std::string sourceFileName = "<stdin>";
+    /// Count the calls and loop iterations of every function in per-thread tables of the runtime, which are printed as
+    /// a flat profile when the program exits, see 'simplec_profile_enter'.
+    bool instrument = false;
+    /// With 'instrument', also add up the cycles spent in every function as read from the CPU's cycle counter.
+    bool instrumentCycles = false;
+    /// Replace calls with constant arguments by their results before lowering, see 'foldConstantCalls'. Applied by
+    /// 'compile' and 'Engine', not by 'Codegen' itself, and ignored when compiling one function at a time.
+    bool foldConstantCalls = true;
+    /// Names of functions compiled once for the baseline and once more per x86-64 microarchitecture level in
+    /// 'versionLevels', with the best version the running CPU supports selected at startup, see
+    /// 'Codegen::emitVersions'. Ignored unless the target is x86-64. Requires linking against SimpleCRuntime.
+    std::vector<std::string> multiversion;
+    /// Levels 2 to 4 of the x86-64 psABI: 2 adds SSE4.2 and POPCNT, 3 AVX2, FMA and BMI2, and 4 AVX-512.
+    std::vector<unsigned> versionLevels = {3, 4};
+
+    bool operator==(const CodegenOptions& other) const;
+
+    bool operator!=(const CodegenOptions& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+llvm::hash_code hash_value(const CodegenOptions& options);
+
 class Codegen
 {
     std::unique_ptr<llvm::Module> m_module;
+    const llvm::TargetMachine* m_targetMachine;
+    CodegenOptions m_options;
     llvm::Function* m_currentFunc{};
-    std::unordered_map<const Function*, llvm::Function*> m_functionMap;
-    std::unordered_map<const VarDecl*, llvm::AllocaInst*> m_variableMap;
+    /// Indexed by 'Function::index'.
+    std::vector<llvm::Function*> m_functions;
+    /// Indexed by 'VarDecl::slot' of the function currently being lowered.
+    std::vector<llvm::AllocaInst*> m_variables;
     llvm::IRBuilder<> m_builder;
+    FunctionAnalysis m_ownAnalysis;
+    FunctionAnalysis& m_analysis;
+    /// Null unless 'CodegenOptions::debugInfo' is set.
+    std::unique_ptr<llvm::DIBuilder> m_debugBuilder;
+    llvm::DIFile* m_debugFile{};
+
+    /// Instrumentation of the function currently being lowered, see 'CodegenOptions::instrument'.
+    struct Instrumentation
+    {
+        /// Pointer to the counters returned by 'simplec_profile_enter'.
+        llvm::Value* counters;
+        /// Loop iterations of the current call so far.
+        llvm::AllocaInst* iterations;
+        /// Cycle counter on entry. Null unless cycles are measured.
+        llvm::Value* startCycles;
+    };
+    std::optional<Instrumentation> m_instrumentation;
+
+    /// Self recursion of the current function in tail position jumps here, right after the parameters were stored.
+    /// Null if the function does not call itself.
+    llvm::BasicBlock* m_recursionEntry{};
+    /// Accumulator of the current function, see 'FunctionProperties::accumulator'. Null if it has none.
+    llvm::AllocaInst* m_accumulator{};
+    Token::TokenType m_accumulatorOperation{};
+
+    /// Module constructor selecting the versions of multiversioned functions, created along with the first one. Its
+    /// entry block ends in the stores selecting them, after the call to 'simplec_cpu_level' returning 'm_cpuLevel'.
+    llvm::Function* m_versionSelector{};
+    llvm::Value* m_cpuLevel{};
+
+    /// Compiles 'function' and its batch entry point, if any, into one internal copy per level in
+    /// 'CodegenOptions::versionLevels' and one for the baseline, named '<name>.x86-64-v<level>' and '<name>.default',
+    /// that differ in their 'target-cpu' only. The original functions become dispatchers tail calling the copy stored
+    /// in a function pointer by 'm_versionSelector'. The pointer is set before 'main' and never changes afterwards, so
+    /// it is loaded as invariant and the dispatchers keep the attributes of the function. Until it is set, e.g. if the
+    /// module is JIT compiled without running its constructors, it holds the baseline version.
+    void emitVersions(const Function& function);
+
+    /// Lowers 'return <call>' or, with an accumulator, 'return <call> op <operand>' where 'call' calls the current
+    /// function itself, into storing the arguments to the parameters and jumping to 'm_recursionEntry'. Deep
+    /// recursion thereby runs in constant stack space regardless of the optimization level.
+    void emitSelfTailCall(const CallExpression& call, const Expression* operand);
+
+    /// Lowers 'return <expression>'.
+    void emitReturn(const Expression& expression);
+
+    /// Emits the entry half of the instrumentation of 'function' at the current insert point.
+    void beginInstrumentation(const Function& function);
+
+    /// Adds 'count' loop iterations to the current function. Does nothing if it is not instrumented.
+    void countIterations(llvm::Value* count);
+
+    /// Adds the current call to the counters, to be emitted before every return.
+    void endInstrumentation();
+
+    /// Attaches debug info describing a function called 'name', defined on 'line', to 'function'. Does nothing unless
+    /// debug info is enabled.
+    void addSubprogram(llvm::Function& function, llvm::StringRef name, std::size_t line);
+
+    /// Adds the attributes derived from the target and the options, which every function in the module carries.
+    void addTargetAttributes(llvm::Function& function);
+
+    /// Returns the LLVM function of 'function' within the module, declaring it first if needed. 'function' must have
+    /// been analyzed.
+    llvm::Function* declare(const Function& function);
 
     llvm::Value* boolean(llvm::Value* value);
 
+    /// Converts 'value' of type 'from' to type 'to', broadcasting scalars converted to vectors.
+    llvm::Value* convert(llvm::Value* value, Type from, Type to);
+
+    /// Emits one of the vector builtins.
+    llvm::Value* emit(const BuiltinExpression& builtin, llvm::ArrayRef<llvm::Value*> operands);
+
+    /// Outlines the body of 'loop' into a function covering a range of iterations and hands it to the runtime.
+    void visit(const Statement::ParallelFor& loop);
+
+    /// Emits 'void <name>.batch(const T0* in0, ..., const Tn* inN, R* out, i64 count)' for 'function', which stores
+    /// '<name>(in0[i], ..., inN[i])' into 'out[i]' for every 'i' below 'count'. 'bool' elements are one byte wide. The
+    /// call is inlined and the loop vectorized by the optimizer, so applying a function over columns of data costs a
+    /// few SIMD loops instead of a call per row. The arrays must not overlap.
+    void emitBatchEntryPoint(const Function& function);
+
+    /// Atomically combines 'value' into the variable of type 'type' at 'pointer' using the reduction 'operation'.
+    void emitAtomicReduction(Token::TokenType operation, Type type, llvm::Value* pointer, llvm::Value* value);
+
+    /// Emits the operation performed by 'expression' itself, given the already lowered values of its operands.
+    llvm::Value* emit(const Expression& expression, llvm::ArrayRef<llvm::Value*> operands);
+
 public:
     [[nodiscard]] llvm::Module* getModule() const
     {
         return m_module.get();
     }
 
-    explicit Codegen(llvm::LLVMContext& context);
+    /// Finalizes debug info and transfers ownership of the module to the caller. The 'Codegen' instance must not be
+    /// visited afterwards.
+    std::unique_ptr<llvm::Module> takeModule()
+    {
+        if (m_debugBuilder)
+        {
+            m_debugBuilder->finalize();
+        }
+        return std::move(m_module);
+    }
+
+    /// If 'targetMachine' is non-null the module is stamped with its target triple and data layout, and every function
+    /// with its CPU and features.
+    ///
+    /// A file may be split across modules by lowering its functions with several instances, in order of definition,
+    /// sharing one 'analysis'. Functions defined by another instance are declared where they are called. If 'analysis'
+    /// is null the instance uses one of its own.
+    explicit Codegen(llvm::LLVMContext& context, const llvm::TargetMachine* targetMachine = nullptr,
+                     CodegenOptions options = {}, FunctionAnalysis* analysis = nullptr);
 
     llvm::Type* visit(const Type& type);
 
@@ -41,5 +191,7 @@ public:
 
     void visit(const Statement& statement);
 
+    /// Lowers 'expression' using an explicit work list instead of recursion, so that arbitrarily deep expressions can
+    /// be compiled in constant stack space.
     llvm::Value* visit(const Expression& expression);
 };
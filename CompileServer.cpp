@@ -0,0 +1,268 @@
+#include "CompileServer.hpp"
+
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Driver.hpp"
+#include "Error.hpp"
+
+namespace
+{
+/// An 'LLVMContext' never frees uniqued types and constants. Recreating it every so often keeps the memory of a
+/// long-running server bounded by the working set of recent requests.
+constexpr std::size_t CONTEXT_RESET_INTERVAL = 1024;
+
+/// Limits on reading a request and writing its response, so that a client that never finishes its request, never reads
+/// the response or keeps on sending cannot tie up a worker or exhaust memory. Reading and writing get
+/// 'REQUEST_TIMEOUT' each.
+constexpr std::chrono::seconds REQUEST_TIMEOUT(30);
+constexpr std::size_t MAX_REQUEST_SIZE = 16 << 20;
+
+llvm::Error errnoError(const llvm::Twine& what)
+{
+    return llvm::createStringError(std::error_code(errno, std::generic_category()), what + ": " + std::strerror(errno));
+}
+
+/// Makes blocking reads, for 'option' 'SO_RCVTIMEO', or writes, for 'SO_SNDTIMEO', on 'fd' give up at 'deadline'. Fails
+/// if 'deadline' has passed, naming 'what' was not completed in time.
+llvm::Error setDeadline(int fd, int option, std::chrono::steady_clock::time_point deadline, const char* what)
+{
+    auto remaining =
+        std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0)
+    {
+        return llvm::createStringError(std::errc::timed_out, "%s not completed within %lld seconds", what,
+                                       static_cast<long long>(REQUEST_TIMEOUT.count()));
+    }
+    timeval timeout{static_cast<time_t>(remaining / 1'000'000), static_cast<suseconds_t>(remaining % 1'000'000)};
+    if (::setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout)) < 0)
+    {
+        return errnoError("setsockopt");
+    }
+    return llvm::Error::success();
+}
+
+/// Reads until the client shuts down its writing end, which must happen within 'REQUEST_TIMEOUT' of the call and
+/// after at most 'MAX_REQUEST_SIZE' bytes.
+llvm::Expected<std::string> readRequest(int fd)
+{
+    auto deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+    std::string result;
+    char buffer[4096];
+    while (true)
+    {
+        if (auto error = setDeadline(fd, SO_RCVTIMEO, deadline, "request"))
+        {
+            return error;
+        }
+        auto count = ::read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Checked at the top of the loop.
+            continue;
+        }
+        if (count < 0)
+        {
+            return errnoError("read");
+        }
+        if (count == 0)
+        {
+            return result;
+        }
+        if (result.size() + count > MAX_REQUEST_SIZE)
+        {
+            return llvm::createStringError(std::errc::message_size, "request exceeds %zu bytes", MAX_REQUEST_SIZE);
+        }
+        result.append(buffer, count);
+    }
+}
+
+/// Writes 'data' to 'fd', giving up if the client has not taken all of it within 'REQUEST_TIMEOUT' of the call.
+void writeAll(int fd, std::string_view data)
+{
+    auto deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+    while (!data.empty())
+    {
+        if (auto error = setDeadline(fd, SO_SNDTIMEO, deadline, "response"))
+        {
+            llvm::consumeError(std::move(error));
+            return;
+        }
+        auto count = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // A timeout is checked at the top of the loop.
+            continue;
+        }
+        if (count <= 0)
+        {
+            return;
+        }
+        data.remove_prefix(count);
+    }
+}
+
+} // namespace
+
+llvm::Expected<std::unique_ptr<CompileServer>> CompileServer::create(std::string socketPath, unsigned threadCount)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        return llvm::createStringError(std::errc::filename_too_long, "socket path '%s' is too long",
+                                       socketPath.c_str());
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    std::vector<Worker> workers;
+    for (unsigned i = 0; i < threadCount; i++)
+    {
+        auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+        if (!builder)
+        {
+            return builder.takeError();
+        }
+        auto targetMachine = builder->createTargetMachine();
+        if (!targetMachine)
+        {
+            return targetMachine.takeError();
+        }
+        workers.push_back(
+            {llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>()), std::move(*targetMachine)});
+    }
+
+    std::unique_ptr<CompileServer> server(new CompileServer(std::move(socketPath)));
+    server->m_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->m_listenFd < 0)
+    {
+        return errnoError("socket");
+    }
+    ::unlink(server->m_socketPath.c_str());
+    if (::bind(server->m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        return errnoError("bind to '" + server->m_socketPath + "'");
+    }
+    if (::listen(server->m_listenFd, SOMAXCONN) < 0)
+    {
+        return errnoError("listen");
+    }
+
+    for (auto& iter : workers)
+    {
+        server->m_threads.emplace_back(&CompileServer::workerLoop, server.get(), std::move(iter));
+    }
+    return server;
+}
+
+CompileServer::~CompileServer()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_condition.notify_all();
+    for (auto& iter : m_threads)
+    {
+        iter.join();
+    }
+    for (int iter : m_pending)
+    {
+        ::close(iter);
+    }
+    if (m_listenFd >= 0)
+    {
+        ::close(m_listenFd);
+        ::unlink(m_socketPath.c_str());
+    }
+}
+
+llvm::Error CompileServer::run()
+{
+    while (true)
+    {
+        int connection = ::accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return errnoError("accept");
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending.push_back(connection);
+        }
+        m_condition.notify_one();
+    }
+}
+
+void CompileServer::workerLoop(Worker worker)
+{
+    while (true)
+    {
+        int connection;
+        {
+            std::unique_lock lock(m_mutex);
+            m_condition.wait(lock, [&] { return m_shutdown || !m_pending.empty(); });
+            if (m_shutdown)
+            {
+                return;
+            }
+            connection = m_pending.front();
+            m_pending.pop_front();
+        }
+        serve(worker, connection);
+        ::close(connection);
+    }
+}
+
+void CompileServer::serve(Worker& worker, int connection)
+{
+    if (++worker.requestsSinceReset == CONTEXT_RESET_INTERVAL)
+    {
+        worker.context = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+        worker.requestsSinceReset = 0;
+    }
+
+    auto source = readRequest(connection);
+    if (!source)
+    {
+        writeAll(connection, "error: " + llvm::toString(source.takeError()) + '\n');
+        return;
+    }
+    std::string response;
+    {
+        auto lock = worker.context.getLock();
+        try
+        {
+            auto module = compile(*source, *worker.context.getContext(), worker.targetMachine.get());
+            llvm::raw_string_ostream os(response);
+            module->print(os, nullptr);
+        }
+        catch (const CompileError& e)
+        {
+            response = e.what();
+            response += '\n';
+        }
+        catch (const std::exception& e)
+        {
+            response = std::string("error: ") + e.what() + '\n';
+        }
+    }
+    writeAll(connection, response);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Long-running compile daemon. LLVM is initialized once per process and every connection accepted on a Unix domain
+/// socket is handed to a fixed pool of workers. Each worker owns a 'ThreadSafeContext' and a host 'TargetMachine'
+/// which are reused across requests, so a request only pays for lexing, parsing and codegen.
+///
+/// Protocol: The client writes the complete source text and shuts down its writing end. The server answers with the
+/// textual LLVM IR of the module, or with a single line starting with "error: " if the source was malformed, and
+/// closes the connection. Requests larger than 16 MiB, or not completed within 30 seconds of the worker picking up
+/// the connection, are answered with an error without being compiled. A response the client has not read within 30
+/// seconds is abandoned.
+class CompileServer
+{
+    struct Worker
+    {
+        llvm::orc::ThreadSafeContext context;
+        std::unique_ptr<llvm::TargetMachine> targetMachine;
+        std::size_t requestsSinceReset = 0;
+    };
+
+    std::string m_socketPath;
+    int m_listenFd = -1;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<int> m_pending;
+    bool m_shutdown = false;
+    std::vector<std::thread> m_threads;
+
+    void workerLoop(Worker worker);
+
+    static void serve(Worker& worker, int connection);
+
+    explicit CompileServer(std::string socketPath) : m_socketPath(std::move(socketPath)) {}
+
+public:
+    /// Binds to 'socketPath', replacing a stale socket file if present, and spawns 'threadCount' workers.
+    static llvm::Expected<std::unique_ptr<CompileServer>> create(std::string socketPath, unsigned threadCount);
+
+    ~CompileServer();
+
+    CompileServer(const CompileServer&) = delete;
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    /// Accepts connections until an unrecoverable error occurs.
+    llvm::Error run();
+};
@@ -0,0 +1,607 @@
+#include "Driver.hpp"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SmallVectorMemoryBuffer.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "Parser.hpp"
+#include "Runtime.hpp"
+
+namespace
+{
+/// Appends every function of every loaded object to '/tmp/perf-<pid>.map', in the format documented in
+/// 'tools/perf/Documentation/jit-interface.txt' of the Linux sources.
+class PerfMapListener : public llvm::JITEventListener
+{
+    std::mutex m_mutex;
+    std::unique_ptr<llvm::raw_fd_ostream> m_output;
+
+public:
+    PerfMapListener()
+    {
+        std::string path = "/tmp/perf-" + std::to_string(llvm::sys::Process::getProcessId()) + ".map";
+        std::error_code ec;
+        m_output = std::make_unique<llvm::raw_fd_ostream>(path, ec, llvm::sys::fs::OF_Append);
+        if (ec)
+        {
+            llvm::errs() << "warning: could not open '" << path << "': " << ec.message() << '\n';
+            m_output.reset();
+        }
+    }
+
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile& object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo& info) override
+    {
+        if (!m_output)
+        {
+            return;
+        }
+        // The debug object has its sections relocated to the addresses they were loaded at.
+        auto debugObject = info.getObjectForDebug(object);
+        const auto& loaded = debugObject.getBinary() ? *debugObject.getBinary() : object;
+        std::lock_guard lock(m_mutex);
+        for (auto& [symbol, size] : llvm::object::computeSymbolSizes(loaded))
+        {
+            auto type = symbol.getType();
+            auto name = symbol.getName();
+            auto address = symbol.getAddress();
+            if (!type || !name || !address || *type != llvm::object::SymbolRef::ST_Function)
+            {
+                llvm::consumeError(type.takeError());
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(address.takeError());
+                continue;
+            }
+            *m_output << llvm::format_hex_no_prefix(*address, 1) << ' ' << llvm::format_hex_no_prefix(size, 1) << ' '
+                      << *name << '\n';
+        }
+        m_output->flush();
+    }
+};
+
+/// Hands items from one stage of 'compileStreaming' to the next. Producers block while the queue is full, which keeps
+/// a fast stage from running ahead of a slow one and piling up memory.
+template <class T>
+class BoundedQueue
+{
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<T> m_items;
+    std::size_t m_capacity;
+    bool m_closed = false;
+
+public:
+    explicit BoundedQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+    /// Returns false, dropping 'item', if the queue has been closed.
+    bool push(T item)
+    {
+        std::unique_lock lock(m_mutex);
+        m_changed.wait(lock, [&] { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed)
+        {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_changed.notify_all();
+        return true;
+    }
+
+    /// Returns an empty optional once the queue has been closed and all items were taken.
+    std::optional<T> pop()
+    {
+        std::unique_lock lock(m_mutex);
+        m_changed.wait(lock, [&] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+        {
+            return std::nullopt;
+        }
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        m_changed.notify_all();
+        return item;
+    }
+
+    void close()
+    {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+        m_changed.notify_all();
+    }
+};
+
+} // namespace
+
+std::unique_ptr<llvm::Module> compile(std::string_view source, llvm::LLVMContext& context,
+                                      const llvm::TargetMachine* targetMachine, const CodegenOptions& options,
+                                      std::vector<FoldedCall>* folded)
+{
+    auto tokens = tokenize(source);
+    auto file = Parser(tokens.begin(), tokens.end()).parseFile();
+    if (options.foldConstantCalls)
+    {
+        EvaluationLimits limits;
+        limits.floatingPoint = !options.fastMath.any();
+        foldConstantCalls(file, limits, folded);
+    }
+
+    Codegen codegen(context, targetMachine, options);
+    codegen.visit(file);
+    return codegen.takeModule();
+}
+
+llvm::Error compileStreaming(std::string_view source, const StreamingOptions& options, ObjectConsumer consumer)
+{
+    struct Lowered
+    {
+        std::size_t index;
+        std::string name;
+        std::unique_ptr<llvm::LLVMContext> context;
+        std::unique_ptr<llvm::Module> module;
+    };
+    unsigned threads = std::max(1u, options.threads);
+    BoundedQueue<Function*> parsed(2 * threads);
+    BoundedQueue<Lowered> lowered(2 * threads);
+
+    std::mutex consumerMutex;
+    std::mutex errorMutex;
+    llvm::Error firstError = llvm::Error::success();
+    std::atomic<bool> failed = false;
+    auto fail = [&](llvm::Error error)
+    {
+        {
+            std::lock_guard lock(errorMutex);
+            if (firstError)
+            {
+                llvm::consumeError(std::move(error));
+            }
+            else
+            {
+                firstError = std::move(error);
+            }
+        }
+        failed = true;
+        parsed.close();
+        lowered.close();
+    };
+    auto createWorkerTargetMachine = [&]
+    { return createTargetMachine(options.triple, options.optLevel, options.cpu, options.features); };
+
+    // Functions are lowered in order of definition on a single thread, as their analysis depends on that of their
+    // callees. Every function gets a context of its own, so that it can be optimized independently of the others.
+    std::thread lowering(
+        [&]
+        {
+            auto targetMachine = createWorkerTargetMachine();
+            if (!targetMachine)
+            {
+                fail(targetMachine.takeError());
+                return;
+            }
+            FunctionAnalysis analysis;
+            while (auto function = parsed.pop())
+            {
+                if ((*function)->external)
+                {
+                    analysis.analyze(**function);
+                    continue;
+                }
+                auto context = std::make_unique<llvm::LLVMContext>();
+                Codegen codegen(*context, targetMachine->get(), options.codegen, &analysis);
+                codegen.visit(**function);
+                // Only the signature is needed from here on, for calls from the functions following.
+                (*function)->body.clear();
+                (*function)->body.shrink_to_fit();
+                if (!lowered.push({(*function)->index, (*function)->identifier, std::move(context),
+                                   codegen.takeModule()}))
+                {
+                    return;
+                }
+            }
+            lowered.close();
+        });
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        workers.emplace_back(
+            [&]
+            {
+                auto targetMachine = createWorkerTargetMachine();
+                if (!targetMachine)
+                {
+                    fail(targetMachine.takeError());
+                    return;
+                }
+                while (auto item = lowered.pop())
+                {
+                    optimize(*item->module, options.optLevel, targetMachine->get());
+                    llvm::SmallVector<char, 0> buffer;
+                    llvm::raw_svector_ostream os(buffer);
+                    if (auto error = emitFile(*item->module, **targetMachine, llvm::CGFT_ObjectFile, os))
+                    {
+                        fail(std::move(error));
+                        return;
+                    }
+                    item->module.reset();
+                    item->context.reset();
+                    auto object = std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(buffer), item->name + ".o",
+                                                                                  false);
+                    std::unique_lock lock(consumerMutex);
+                    if (failed)
+                    {
+                        return;
+                    }
+                    if (auto error = consumer(item->index, item->name, std::move(object)))
+                    {
+                        lock.unlock();
+                        fail(std::move(error));
+                        return;
+                    }
+                }
+            });
+    }
+    auto join = [&]
+    {
+        parsed.close();
+        lowering.join();
+        for (auto& iter : workers)
+        {
+            iter.join();
+        }
+    };
+
+    // Functions are owned here, as later functions refer to the ones before them.
+    std::vector<std::unique_ptr<Function>> functions;
+    try
+    {
+        Lexer lexer(source);
+        Parser parser({}, {});
+        std::vector<Token> tokens;
+        // A function ends with the brace closing its body, an 'extern' declaration with a semicolon.
+        int depth = 0;
+        while (!failed)
+        {
+            auto token = lexer.next();
+            if (token)
+            {
+                auto type = token->tokenType;
+                depth += type == Token::OpenBrace ? 1 : type == Token::CloseBrace ? -1 : 0;
+                tokens.push_back(std::move(*token));
+                if ((type != Token::CloseBrace && type != Token::SemiColon) || depth > 0)
+                {
+                    continue;
+                }
+                depth = 0;
+            }
+            parser.setTokens(tokens.begin(), tokens.end());
+            for (auto& iter : parser.parseFile().functions)
+            {
+                functions.push_back(std::move(iter));
+                parsed.push(functions.back().get());
+            }
+            tokens.clear();
+            if (!token)
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        lowered.close();
+        join();
+        llvm::consumeError(std::move(firstError));
+        throw;
+    }
+    join();
+    return firstError;
+}
+
+llvm::CodeGenOpt::Level codeGenOptLevel(unsigned optLevel)
+{
+    switch (optLevel)
+    {
+        case 0: return llvm::CodeGenOpt::None;
+        case 1: return llvm::CodeGenOpt::Less;
+        case 2: return llvm::CodeGenOpt::Default;
+        default: return llvm::CodeGenOpt::Aggressive;
+    }
+}
+
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(const llvm::Triple& triple,
+                                                                         unsigned optLevel, llvm::StringRef cpu,
+                                                                         llvm::StringRef features)
+{
+    std::string error;
+    const auto* target = llvm::TargetRegistry::lookupTarget(triple.str(), error);
+    if (!target)
+    {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), error);
+    }
+
+    std::string cpuName = cpu.str();
+    llvm::SubtargetFeatures subtargetFeatures;
+    if (cpu == "native")
+    {
+        if (triple.getArch() != llvm::Triple(llvm::sys::getProcessTriple()).getArch())
+        {
+            return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                           "'-mcpu=native' is only supported when compiling for the host");
+        }
+        cpuName = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures))
+        {
+            for (auto& iter : hostFeatures)
+            {
+                subtargetFeatures.AddFeature(iter.first(), iter.second);
+            }
+        }
+    }
+    if (!features.empty())
+    {
+        llvm::SmallVector<llvm::StringRef> split;
+        features.split(split, ',', -1, false);
+        for (auto iter : split)
+        {
+            subtargetFeatures.AddFeature(iter);
+        }
+    }
+
+    return std::unique_ptr<llvm::TargetMachine>(
+        target->createTargetMachine(triple.str(), cpuName, subtargetFeatures.getString(), {}, llvm::Reloc::PIC_,
+                                    llvm::None, codeGenOptLevel(optLevel)));
+}
+
+void optimize(llvm::Module& module, unsigned optLevel, llvm::TargetMachine* targetMachine, bool wholeProgram)
+{
+    llvm::LoopAnalysisManager loopAnalysisManager;
+    llvm::FunctionAnalysisManager functionAnalysisManager;
+    llvm::CGSCCAnalysisManager cgsccAnalysisManager;
+    llvm::ModuleAnalysisManager moduleAnalysisManager;
+
+    llvm::PassBuilder passBuilder(targetMachine);
+    passBuilder.registerModuleAnalyses(moduleAnalysisManager);
+    passBuilder.registerCGSCCAnalyses(cgsccAnalysisManager);
+    passBuilder.registerFunctionAnalyses(functionAnalysisManager);
+    passBuilder.registerLoopAnalyses(loopAnalysisManager);
+    passBuilder.crossRegisterProxies(loopAnalysisManager, functionAnalysisManager, cgsccAnalysisManager,
+                                     moduleAnalysisManager);
+
+    llvm::ModulePassManager modulePassManager;
+    if (wholeProgram)
+    {
+        modulePassManager.addPass(
+            llvm::InternalizePass([](const llvm::GlobalValue& value) { return value.hasDefaultVisibility(); }));
+        modulePassManager.addPass(llvm::GlobalDCEPass());
+    }
+    llvm::OptimizationLevel level;
+    switch (optLevel)
+    {
+        case 0: level = llvm::OptimizationLevel::O0; break;
+        case 1: level = llvm::OptimizationLevel::O1; break;
+        case 2: level = llvm::OptimizationLevel::O2; break;
+        default: level = llvm::OptimizationLevel::O3; break;
+    }
+    if (optLevel == 0)
+    {
+        modulePassManager.addPass(passBuilder.buildO0DefaultPipeline(level));
+    }
+    else if (wholeProgram)
+    {
+        // The same split as in full LTO: Simplify every function first, then optimize across the whole module, with
+        // another round of inlining and interprocedural constant propagation, before the loop optimizations.
+        modulePassManager.addPass(passBuilder.buildLTOPreLinkDefaultPipeline(level));
+        modulePassManager.addPass(passBuilder.buildLTODefaultPipeline(level, nullptr));
+    }
+    else
+    {
+        modulePassManager.addPass(passBuilder.buildPerModuleDefaultPipeline(level));
+    }
+    modulePassManager.run(module, moduleAnalysisManager);
+}
+
+llvm::cl::opt<bool>& fastMathOption()
+{
+    auto& registered = llvm::cl::getRegisteredOptions();
+    if (auto iter = registered.find("ffast-math"); iter != registered.end())
+    {
+        return *static_cast<llvm::cl::opt<bool>*>(iter->second);
+    }
+    static llvm::cl::opt<bool> option("ffast-math", llvm::cl::desc("Enable all floating point relaxations"));
+    return option;
+}
+
+llvm::Error emitFile(llvm::Module& module, llvm::TargetMachine& targetMachine, llvm::CodeGenFileType fileType,
+                     llvm::raw_pwrite_stream& os)
+{
+    llvm::legacy::PassManager passManager;
+    if (targetMachine.addPassesToEmitFile(passManager, os, nullptr, fileType))
+    {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "target '" + targetMachine.getTargetTriple().str()
+                                           + "' cannot emit a file of this type");
+    }
+    passManager.run(module);
+    return llvm::Error::success();
+}
+
+llvm::Error emitObjectsParallel(llvm::Module& module, const llvm::TargetMachine& targetMachine, unsigned partitions,
+                                ObjectConsumer consumer)
+{
+    // The external symbols defined by the module are defined by no other object of the link, so a hash of their names
+    // qualifies the local ones well enough. Hashing with MD5 keeps the output deterministic.
+    std::vector<llvm::StringRef> definitions;
+    for (auto& iter : module.global_values())
+    {
+        if (!iter.isDeclaration() && !iter.hasLocalLinkage() && !iter.hasAppendingLinkage())
+        {
+            definitions.push_back(iter.getName());
+        }
+    }
+    std::sort(definitions.begin(), definitions.end());
+    llvm::MD5 md5;
+    for (auto iter : definitions)
+    {
+        md5.update(iter);
+        md5.update(llvm::ArrayRef<std::uint8_t>{0});
+    }
+    llvm::MD5::MD5Result digest;
+    md5.final(digest);
+    std::string suffix = "." + digest.digest().substr(0, 16).str();
+    for (auto& iter : module.global_values())
+    {
+        if (iter.hasLocalLinkage())
+        {
+            iter.setName((iter.hasName() ? iter.getName() : "anon") + suffix);
+        }
+    }
+
+    std::mutex mutex;
+    llvm::Error firstError = llvm::Error::success();
+    std::vector<std::thread> threads;
+    llvm::SplitModule(
+        module, partitions,
+        [&](std::unique_ptr<llvm::Module> partition)
+        {
+            // Contexts are not thread-safe, so the partition moves over to the thread's own as bitcode.
+            llvm::SmallVector<char, 0> bitcode;
+            llvm::raw_svector_ostream bitcodeStream(bitcode);
+            llvm::WriteBitcodeToFile(*partition, bitcodeStream);
+            partition.reset();
+            threads.emplace_back(
+                [&, index = threads.size(), bitcode = std::move(bitcode)]
+                {
+                    auto name = "partition" + std::to_string(index);
+                    auto run = [&]() -> llvm::Error
+                    {
+                        llvm::LLVMContext context;
+                        auto loaded =
+                            llvm::parseBitcodeFile(llvm::MemoryBufferRef({bitcode.data(), bitcode.size()}, name),
+                                                   context);
+                        if (!loaded)
+                        {
+                            return loaded.takeError();
+                        }
+                        std::unique_ptr<llvm::TargetMachine> threadTargetMachine(
+                            targetMachine.getTarget().createTargetMachine(
+                                targetMachine.getTargetTriple().str(), targetMachine.getTargetCPU(),
+                                targetMachine.getTargetFeatureString(), targetMachine.Options,
+                                targetMachine.getRelocationModel(), targetMachine.getCodeModel(),
+                                targetMachine.getOptLevel()));
+                        llvm::SmallVector<char, 0> buffer;
+                        llvm::raw_svector_ostream os(buffer);
+                        if (auto error = emitFile(**loaded, *threadTargetMachine, llvm::CGFT_ObjectFile, os))
+                        {
+                            return error;
+                        }
+                        auto object =
+                            std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(buffer), name + ".o", false);
+                        std::lock_guard lock(mutex);
+                        if (firstError)
+                        {
+                            return llvm::Error::success();
+                        }
+                        return consumer(index, name, std::move(object));
+                    };
+                    if (auto error = run())
+                    {
+                        std::lock_guard lock(mutex);
+                        if (firstError)
+                        {
+                            llvm::consumeError(std::move(error));
+                        }
+                        else
+                        {
+                            firstError = std::move(error);
+                        }
+                    }
+                });
+        },
+        false);
+    for (auto& iter : threads)
+    {
+        iter.join();
+    }
+    return firstError;
+}
+
+llvm::Error addHostSymbols(llvm::orc::LLJIT& jit)
+{
+    llvm::orc::MangleAndInterner mangle(jit.getExecutionSession(), jit.getDataLayout());
+    llvm::orc::SymbolMap symbols;
+    symbols[mangle("simplec_parallel_for")] = llvm::JITEvaluatedSymbol::fromPointer(&simplec_parallel_for);
+    symbols[mangle("simplec_profile_enter")] = llvm::JITEvaluatedSymbol::fromPointer(&simplec_profile_enter);
+    symbols[mangle("simplec_cpu_level")] = llvm::JITEvaluatedSymbol::fromPointer(&simplec_cpu_level);
+    auto& dylib = jit.getMainJITDylib();
+    if (auto error = dylib.define(llvm::orc::absoluteSymbols(std::move(symbols))))
+    {
+        return error;
+    }
+    auto generator =
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit.getDataLayout().getGlobalPrefix());
+    if (!generator)
+    {
+        return generator.takeError();
+    }
+    dylib.addGenerator(std::move(*generator));
+    return llvm::Error::success();
+}
+
+void enableProfiling(llvm::orc::LLJITBuilder& builder, const ProfilingOptions& options)
+{
+    if (!options.perfMap && !options.jitdump)
+    {
+        return;
+    }
+    builder.setObjectLinkingLayerCreator(
+        [options](llvm::orc::ExecutionSession& session, const llvm::Triple&)
+            -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>
+        {
+            auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                session, [] { return std::make_unique<llvm::SectionMemoryManager>(); });
+            if (options.perfMap)
+            {
+                // Shared by all JITs of the process, as they all append to the same file.
+                static PerfMapListener perfMapListener;
+                layer->registerJITEventListener(perfMapListener);
+            }
+            if (options.jitdump)
+            {
+                auto* listener = llvm::JITEventListener::createPerfJITEventListener();
+                if (!listener)
+                {
+                    return llvm::make_error<llvm::StringError>("LLVM was built without jitdump support",
+                                                               llvm::inconvertibleErrorCode());
+                }
+                layer->registerJITEventListener(*listener);
+            }
+            return layer;
+        });
+}
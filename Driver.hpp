@@ -0,0 +1,129 @@
+#pragma once
+
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Codegen.hpp"
+#include "Evaluator.hpp"
+
+namespace llvm::orc
+{
+class LLJIT;
+class LLJITBuilder;
+} // namespace llvm::orc
+
+/// Runs the whole front end over 'source': lexing, parsing and lowering to LLVM IR inside of 'context'. If
+/// 'targetMachine' is non-null the module is stamped with its target triple and data layout, and all functions with
+/// its CPU and features.
+///
+/// Unless disabled by 'options', calls with constant arguments are folded before lowering and appended to 'folded' if
+/// it is non-null.
+///
+/// Throws 'CompileError' if 'source' is malformed. Does not touch any global state and is therefore safe to call
+/// concurrently, as long as no two calls share the same 'context'.
+std::unique_ptr<llvm::Module> compile(std::string_view source, llvm::LLVMContext& context,
+                                      const llvm::TargetMachine* targetMachine = nullptr,
+                                      const CodegenOptions& options = {}, std::vector<FoldedCall>* folded = nullptr);
+
+/// Creates a target machine for 'triple' at the given optimization level (0 to 3). The target must have been
+/// initialized beforehand. Code is generated position independent, so that the output can be used for both
+/// executables and shared libraries.
+///
+/// 'cpu' and 'features' follow the syntax of '-mcpu' and '-mattr'. A 'cpu' of "native" selects the host CPU together
+/// with every feature it supports. 'features' is applied on top of that.
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(const llvm::Triple& triple,
+                                                                         unsigned optLevel, llvm::StringRef cpu = "",
+                                                                         llvm::StringRef features = "");
+
+llvm::CodeGenOpt::Level codeGenOptLevel(unsigned optLevel);
+
+/// Runs LLVM's default middle end pipeline for 'optLevel' (0 to 3) over 'module'. 'targetMachine' may be null, in
+/// which case no target specific analyses are available to the optimizer.
+///
+/// 'wholeProgram' promises that 'module' is linked with nothing but the runtime and code calling its exported
+/// functions. Functions that are not exported then become internal, so that unused ones are deleted and ones called
+/// only once are inlined without leaving a copy behind, and the module is optimized the way full LTO would.
+void optimize(llvm::Module& module, unsigned optLevel, llvm::TargetMachine* targetMachine, bool wholeProgram = false);
+
+/// Returns the '-ffast-math' command line option. LLVM's Hexagon backend registers an option of the same name, and
+/// registering a name twice is a fatal error, so that one is reused if it is linked in. Must be called before the
+/// command line is parsed.
+llvm::cl::opt<bool>& fastMathOption();
+
+/// Runs the backend of 'targetMachine' over 'module', writing an object or assembly file to 'os'.
+llvm::Error emitFile(llvm::Module& module, llvm::TargetMachine& targetMachine, llvm::CodeGenFileType fileType,
+                     llvm::raw_pwrite_stream& os);
+
+struct StreamingOptions
+{
+    llvm::Triple triple;
+    /// Optimization level (0 to 3) of both the middle end and the backend.
+    unsigned optLevel = 0;
+    /// As for 'createTargetMachine'.
+    std::string cpu;
+    std::string features;
+    CodegenOptions codegen;
+    /// Number of threads optimizing and emitting functions. Lexing and parsing happen on the calling thread and the
+    /// lowering to IR on a thread of its own.
+    unsigned threads = 1;
+};
+
+/// Receives the object file at 'index' within the output, called 'name'.
+using ObjectConsumer = llvm::function_ref<llvm::Error(std::size_t index, llvm::StringRef name,
+                                                      std::unique_ptr<llvm::MemoryBuffer> object)>;
+
+/// Compiles 'source' one function at a time: Every function is parsed, lowered into a module of its own, optimized and
+/// emitted as an object file, which is handed to 'consumer' with the index and name of the function. Its syntax tree
+/// and IR are freed right after, keeping only its signature for the functions following it. The stages run
+/// concurrently on different functions, connected by queues of bounded length, so that peak memory grows with the
+/// largest function and the number of threads rather than with the size of the source.
+///
+/// As the optimizer only ever sees one function (together with the functions outlined from it), nothing is inlined
+/// across functions. 'consumer' is called in no particular order, but never concurrently. 'extern' functions produce
+/// no object.
+///
+/// Throws 'CompileError' if 'source' is malformed. Returns the first error of the backend or of 'consumer', after
+/// which no more functions are compiled.
+llvm::Error compileStreaming(std::string_view source, const StreamingOptions& options, ObjectConsumer consumer);
+
+/// Runs the backend of 'targetMachine' over 'module' split into 'partitions' modules by 'llvm::SplitModule', emitting
+/// one object file per partition, named 'partition<index>.o'. Every partition is compiled on a thread of its own, with
+/// a context and target machine of its own, starting as soon as it has been split off. 'consumer' is called in no
+/// particular order, but never concurrently.
+///
+/// Partitions refer to each other's local symbols, which therefore become hidden globals. They are renamed to stay
+/// unique within the link, so that the objects can be linked like the single object 'emitFile' would produce.
+///
+/// Returns the first error of the backend or of 'consumer'. 'module' is left in an unspecified state.
+llvm::Error emitObjectsParallel(llvm::Module& module, const llvm::TargetMachine& targetMachine, unsigned partitions,
+                                ObjectConsumer consumer);
+
+/// Ways of making JIT compiled functions visible to Linux 'perf'.
+struct ProfilingOptions
+{
+    /// Append the address range and name of every function to '/tmp/perf-<pid>.map', which 'perf report' picks up
+    /// without further steps.
+    bool perfMap = false;
+    /// Write a jitdump file to '$JITDUMPDIR/.debug/jit' or '~/.debug/jit', including line info of functions compiled
+    /// with 'CodegenOptions::debugInfo'. Record with 'perf record -k 1' and run 'perf inject --jit' before reporting.
+    bool jitdump = false;
+};
+
+/// Configures 'builder' to use an object linking layer reporting every loaded object as selected by 'options'.
+void enableProfiling(llvm::orc::LLJITBuilder& builder, const ProfilingOptions& options);
+
+/// Makes the functions of 'SimpleCRuntime', which generated code may call, and every symbol of the host process, which
+/// 'extern' functions resolve against, visible to the main 'JITDylib' of 'jit'.
+llvm::Error addHostSymbols(llvm::orc::LLJIT& jit);
@@ -0,0 +1,230 @@
+#include "Engine.hpp"
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <sstream>
+
+#include "Error.hpp"
+#include "Evaluator.hpp"
+#include "Parser.hpp"
+
+namespace
+{
+std::size_t hashKernel(std::string_view source, const KernelOptions& options)
+{
+    return llvm::hash_combine(llvm::StringRef(source), options.optLevel, options.wholeProgram, options.codegen);
+}
+
+bool sameOptions(const KernelOptions& lhs, const KernelOptions& rhs)
+{
+    return lhs.optLevel == rhs.optLevel && lhs.wholeProgram == rhs.wholeProgram && lhs.codegen == rhs.codegen;
+}
+
+const char* typeName(Type type)
+{
+    switch (type)
+    {
+        case Type::Integer: return "int";
+        case Type::Double: return "double";
+        case Type::Int8: return "i8";
+        case Type::Int16: return "i16";
+        case Type::Int64: return "i64";
+        case Type::Float: return "float";
+        case Type::Bool: return "bool";
+        case Type::Vec2Int: return "vec2<int>";
+        case Type::Vec4Int: return "vec4<int>";
+        case Type::Vec8Int: return "vec8<int>";
+        case Type::Vec2Double: return "vec2<double>";
+        case Type::Vec4Double: return "vec4<double>";
+        case Type::Vec8Double: return "vec8<double>";
+    }
+    return "";
+}
+
+std::string signature(Type returnType, llvm::ArrayRef<Type> parameters)
+{
+    std::ostringstream result;
+    result << '(';
+    for (std::size_t i = 0; i < parameters.size(); i++)
+    {
+        result << (i == 0 ? "" : ", ") << typeName(parameters[i]);
+    }
+    result << "): " << typeName(returnType);
+    return result.str();
+}
+
+llvm::Error makeError(const llvm::Twine& message)
+{
+    return llvm::make_error<llvm::StringError>(message, llvm::inconvertibleErrorCode());
+}
+
+} // namespace
+
+llvm::Expected<std::unique_ptr<Engine>> Engine::create(const ProfilingOptions& profiling)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!builder)
+    {
+        return builder.takeError();
+    }
+    auto targetMachine = builder->createTargetMachine();
+    if (!targetMachine)
+    {
+        return targetMachine.takeError();
+    }
+    llvm::orc::LLJITBuilder jitBuilder;
+    jitBuilder.setJITTargetMachineBuilder(std::move(*builder));
+    enableProfiling(jitBuilder, profiling);
+    auto jit = jitBuilder.create();
+    if (!jit)
+    {
+        return jit.takeError();
+    }
+    if (auto error = addHostSymbols(**jit))
+    {
+        return error;
+    }
+
+    std::unique_ptr<Engine> engine(new Engine);
+    engine->m_jit = std::move(*jit);
+    engine->m_targetMachine = std::move(*targetMachine);
+    return engine;
+}
+
+Engine::~Engine() = default;
+
+const Engine::Kernel* Engine::find(std::size_t hash, std::string_view source, const KernelOptions& options) const
+{
+    for (const Kernel* iter = m_buckets[hash % BUCKET_COUNT].load(std::memory_order_acquire); iter; iter = iter->next)
+    {
+        if (iter->hash == hash && iter->source == source && sameOptions(iter->options, options))
+        {
+            return iter;
+        }
+    }
+    return nullptr;
+}
+
+llvm::Expected<const Engine::Kernel*> Engine::compileKernel(std::size_t hash, std::string_view source,
+                                                            const KernelOptions& options)
+{
+    std::lock_guard lock(m_compileMutex);
+    // Another thread may have compiled the same kernel while this one was waiting.
+    if (const Kernel* kernel = find(hash, source, options))
+    {
+        return kernel;
+    }
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    File file;
+    std::unique_ptr<llvm::Module> module;
+    try
+    {
+        auto tokens = tokenize(source);
+        file = Parser(tokens.begin(), tokens.end()).parseFile();
+        if (options.codegen.foldConstantCalls)
+        {
+            EvaluationLimits limits;
+            limits.floatingPoint = !options.codegen.fastMath.any();
+            foldConstantCalls(file, limits);
+        }
+        Codegen codegen(*context, m_targetMachine.get(), options.codegen);
+        codegen.visit(file);
+        module = codegen.takeModule();
+    }
+    catch (const CompileError& e)
+    {
+        return makeError(e.what());
+    }
+    optimize(*module, options.optLevel, m_targetMachine.get(), options.wholeProgram);
+
+    // Every kernel gets a 'JITDylib' of its own, so that different kernels may define functions of the same name.
+    auto dylib = m_jit->createJITDylib("kernel" + std::to_string(m_dylibCount++));
+    if (!dylib)
+    {
+        return dylib.takeError();
+    }
+    dylib->addToLinkOrder(m_jit->getMainJITDylib());
+    if (auto error = m_jit->addIRModule(*dylib, llvm::orc::ThreadSafeModule(std::move(module), std::move(context))))
+    {
+        return error;
+    }
+    // Runs the module's constructors, e.g. the one selecting the versions of multiversioned functions.
+    if (auto error = m_jit->initialize(*dylib))
+    {
+        return error;
+    }
+
+    auto kernel = std::make_unique<Kernel>();
+    kernel->hash = hash;
+    kernel->source = source;
+    kernel->options = options;
+    for (auto& iter : file.functions)
+    {
+        if (iter->external || (options.wholeProgram && !iter->exported))
+        {
+            continue;
+        }
+        auto symbol = m_jit->lookup(*dylib, iter->identifier);
+        if (!symbol)
+        {
+            return symbol.takeError();
+        }
+        CompiledFunction function{reinterpret_cast<void*>(symbol->getAddress()), nullptr, iter->returnType, {}};
+        if (options.codegen.batchEntryPoints)
+        {
+            auto batchSymbol = m_jit->lookup(*dylib, iter->identifier + ".batch");
+            if (!batchSymbol)
+            {
+                return batchSymbol.takeError();
+            }
+            function.batchAddress = reinterpret_cast<void*>(batchSymbol->getAddress());
+        }
+        for (auto& parameter : iter->parameters)
+        {
+            function.parameters.push_back(parameter->type);
+        }
+        kernel->functions.try_emplace(iter->identifier, std::move(function));
+    }
+
+    auto& bucket = m_buckets[hash % BUCKET_COUNT];
+    kernel->next = bucket.load(std::memory_order_relaxed);
+    bucket.store(kernel.get(), std::memory_order_release);
+    m_kernels.push_back(std::move(kernel));
+    return m_kernels.back().get();
+}
+
+llvm::Expected<void*> Engine::lookupAddress(std::string_view source, std::string_view name,
+                                            const KernelOptions& options, Type returnType,
+                                            llvm::ArrayRef<Type> parameters, bool batch)
+{
+    std::size_t hash = hashKernel(source, options);
+    const Kernel* kernel = find(hash, source, options);
+    if (!kernel)
+    {
+        auto compiled = compileKernel(hash, source, options);
+        if (!compiled)
+        {
+            return compiled.takeError();
+        }
+        kernel = *compiled;
+    }
+
+    auto function = kernel->functions.find(name);
+    if (function == kernel->functions.end())
+    {
+        return makeError("error: Unknown function " + llvm::StringRef(name));
+    }
+    const auto& compiled = function->second;
+    if (compiled.returnType != returnType || llvm::makeArrayRef(compiled.parameters) != parameters)
+    {
+        return makeError("error: Function " + llvm::StringRef(name) + " has signature "
+                         + signature(compiled.returnType, compiled.parameters) + " instead of "
+                         + signature(returnType, parameters));
+    }
+    return batch ? compiled.batchAddress : compiled.address;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "Codegen.hpp"
+#include "Driver.hpp"
+#include "Syntax.hpp"
+
+/// Options a kernel is compiled with. Kernels compiled with different options are cached separately.
+struct KernelOptions
+{
+    /// Optimization level of the middle end, 0 to 3.
+    unsigned optLevel = 2;
+    /// Optimize the kernel as a whole program, see 'optimize'. Only its exported functions can be looked up.
+    bool wholeProgram = false;
+    CodegenOptions codegen;
+};
+
+/// The SimpleC type a C++ type is passed as.
+template <class T>
+constexpr Type simpleCType()
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        return Type::Bool;
+    }
+    else if constexpr (std::is_same_v<T, std::int8_t>)
+    {
+        return Type::Int8;
+    }
+    else if constexpr (std::is_same_v<T, std::int16_t>)
+    {
+        return Type::Int16;
+    }
+    else if constexpr (std::is_same_v<T, std::int32_t>)
+    {
+        return Type::Integer;
+    }
+    else if constexpr (std::is_same_v<T, std::int64_t>)
+    {
+        return Type::Int64;
+    }
+    else if constexpr (std::is_same_v<T, float>)
+    {
+        return Type::Float;
+    }
+    else
+    {
+        static_assert(std::is_same_v<T, double>, "type has no SimpleC equivalent");
+        return Type::Double;
+    }
+}
+
+/// Compiles SimpleC source within the process and hands out plain function pointers to the functions defined in it:
+///
+///     auto engine = llvm::cantFail(Engine::create());
+///     auto square = engine->lookup<int(int)>("fun square(x: int): int { return x * x; }", "square");
+///     if (!square) { ... }
+///     int nine = (*square)(3);
+///
+/// Compiled sources ("kernels") are cached for the lifetime of the engine, keyed by their text and 'KernelOptions'.
+/// Looking up a function of a kernel that was compiled before costs a hash of the source and a few atomic loads, and
+/// never takes a lock. Compilation is serialized. All member functions are thread-safe, and function pointers stay
+/// valid until the engine is destroyed.
+class Engine
+{
+    struct CompiledFunction
+    {
+        void* address;
+        /// Null unless the kernel was compiled with 'CodegenOptions::batchEntryPoints'.
+        void* batchAddress;
+        Type returnType;
+        std::vector<Type> parameters;
+    };
+
+    struct Kernel
+    {
+        std::size_t hash;
+        std::string source;
+        KernelOptions options;
+        llvm::StringMap<CompiledFunction> functions;
+        /// Next kernel in the same bucket.
+        const Kernel* next;
+    };
+
+    static constexpr std::size_t BUCKET_COUNT = 1024;
+
+    std::unique_ptr<llvm::orc::LLJIT> m_jit;
+    std::unique_ptr<llvm::TargetMachine> m_targetMachine;
+    /// Heads of singly linked lists of kernels. Kernels are pushed to the front and are immutable once published, so
+    /// readers only need an acquire load per node.
+    std::array<std::atomic<const Kernel*>, BUCKET_COUNT> m_buckets{};
+    /// Guards compilation, 'm_kernels' and 'm_dylibCount'.
+    std::mutex m_compileMutex;
+    std::vector<std::unique_ptr<Kernel>> m_kernels;
+    std::size_t m_dylibCount = 0;
+
+    Engine() = default;
+
+    const Kernel* find(std::size_t hash, std::string_view source, const KernelOptions& options) const;
+
+    llvm::Expected<const Kernel*> compileKernel(std::size_t hash, std::string_view source,
+                                                const KernelOptions& options);
+
+    llvm::Expected<void*> lookupAddress(std::string_view source, std::string_view name, const KernelOptions& options,
+                                        Type returnType, llvm::ArrayRef<Type> parameters, bool batch);
+
+    template <class Signature>
+    struct SignatureTraits;
+
+    template <class R, class... Args>
+    struct SignatureTraits<R(Args...)>
+    {
+        static constexpr Type returnType = simpleCType<R>();
+        static constexpr std::array<Type, sizeof...(Args)> parameters = {simpleCType<Args>()...};
+        using Batch = void(const Args*..., R*, std::int64_t);
+    };
+
+public:
+    /// Creates an engine generating code for the host CPU. The native target is initialized if it was not already.
+    /// Kernels are reported to profilers as selected by 'profiling'.
+    static llvm::Expected<std::unique_ptr<Engine>> create(const ProfilingOptions& profiling = {});
+
+    ~Engine();
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    /// Returns the function 'name' of 'source', compiling 'source' with 'options' unless it has been compiled before.
+    /// Fails if 'source' is malformed, if it does not define 'name', or if 'name' does not have the parameter and
+    /// return types corresponding to 'Signature', e.g. 'double(double, double)'.
+    template <class Signature>
+    llvm::Expected<Signature*> lookup(std::string_view source, std::string_view name,
+                                      const KernelOptions& options = {})
+    {
+        using Traits = SignatureTraits<Signature>;
+        auto address = lookupAddress(source, name, options, Traits::returnType, Traits::parameters, false);
+        if (!address)
+        {
+            return address.takeError();
+        }
+        return reinterpret_cast<Signature*>(*address);
+    }
+
+    /// Like 'lookup', but returns the batch entry point of 'name' (see 'Codegen::emitBatchEntryPoint'). For a
+    /// 'Signature' of 'double(double, int)' its type is 'void(const double*, const int*, double*, std::int64_t)'.
+    /// 'source' is compiled with 'CodegenOptions::batchEntryPoints' regardless of 'options'.
+    template <class Signature>
+    llvm::Expected<typename SignatureTraits<Signature>::Batch*> lookupBatch(std::string_view source,
+                                                                             std::string_view name,
+                                                                             KernelOptions options = {})
+    {
+        using Traits = SignatureTraits<Signature>;
+        options.codegen.batchEntryPoints = true;
+        auto address = lookupAddress(source, name, options, Traits::returnType, Traits::parameters, true);
+        if (!address)
+        {
+            return address.takeError();
+        }
+        return reinterpret_cast<typename Traits::Batch*>(*address);
+    }
+};
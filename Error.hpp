@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdexcept>
+
+/// Thrown by the lexer and parser on malformed input. 'what()' contains the complete diagnostic, ready to be shown
+/// to the user. Nothing is left in an inconsistent state, so a caller may simply move on to the next input.
+class CompileError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
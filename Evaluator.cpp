@@ -0,0 +1,691 @@
+#include "Evaluator.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+
+#include "Analysis.hpp"
+
+namespace
+{
+using Value = std::variant<std::int64_t, double, bool>;
+
+/// Thrown while evaluating something that cannot, or may not, be evaluated at compile time.
+struct Unevaluable
+{
+};
+
+unsigned bitWidth(Type type)
+{
+    switch (type)
+    {
+        case Type::Int8: return 8;
+        case Type::Int16: return 16;
+        case Type::Integer: return 32;
+        default: return 64;
+    }
+}
+
+/// Truncates 'value' to the width of the integer type 'type' and sign extends it back, which is how integers of
+/// every type are held.
+std::int64_t wrap(std::uint64_t value, Type type)
+{
+    unsigned shift = 64 - bitWidth(type);
+    return static_cast<std::int64_t>(value << shift) >> shift;
+}
+
+/// Rounds 'value' to the floating point type 'type'. The results of '+', '-', '*' and '/' on two 'float's computed in
+/// 'double' round to the same 'float' as the operation computed in 'float' directly.
+double round(double value, Type type)
+{
+    return type == Type::Float ? static_cast<float>(value) : value;
+}
+
+std::int64_t integer(const Value& value)
+{
+    if (auto* truthValue = std::get_if<bool>(&value))
+    {
+        return *truthValue;
+    }
+    return std::get<std::int64_t>(value);
+}
+
+/// Mirrors 'Codegen::convert'.
+Value convert(const Value& value, Type to)
+{
+    if (to == Type::Bool)
+    {
+        if (auto* floating = std::get_if<double>(&value))
+        {
+            // Unordered comparison, NaN is true.
+            return !(*floating == 0.0);
+        }
+        return integer(value) != 0;
+    }
+    if (isFloatingPoint(to))
+    {
+        if (auto* floating = std::get_if<double>(&value))
+        {
+            return round(*floating, to);
+        }
+        // Converting from the integer directly rounds once, like the generated code.
+        std::int64_t source = integer(value);
+        return to == Type::Float ? static_cast<double>(static_cast<float>(source)) : static_cast<double>(source);
+    }
+    if (auto* floating = std::get_if<double>(&value))
+    {
+        // Values that do not fit the integer type convert to poison.
+        double truncated = std::trunc(*floating);
+        double limit = std::ldexp(1.0, static_cast<int>(bitWidth(to)) - 1);
+        if (!(truncated >= -limit && truncated < limit))
+        {
+            throw Unevaluable{};
+        }
+        return static_cast<std::int64_t>(truncated);
+    }
+    // 'bool' converts to 1 or 0, everything else is sign extended or truncated.
+    return wrap(static_cast<std::uint64_t>(integer(value)), to);
+}
+
+/// Mirrors the lowering of 'BinaryExpression'. 'operandType' is the type of both operands.
+Value binary(Token::TokenType operation, Type operandType, Type type, const Value& lhs, const Value& rhs)
+{
+    switch (operation)
+    {
+        case Token::OrKeyword: return std::get<bool>(lhs) || std::get<bool>(rhs);
+        case Token::AndKeyword: return std::get<bool>(lhs) && std::get<bool>(rhs);
+        case Token::Less:
+        case Token::LessEqual:
+        case Token::Greater:
+        case Token::GreaterEqual:
+        case Token::Equal:
+        case Token::NotEqual:
+        {
+            if (isFloatingPoint(operandType))
+            {
+                double left = std::get<double>(lhs);
+                double right = std::get<double>(rhs);
+                // All comparisons are unordered, i.e. true if either operand is NaN.
+                if (std::isnan(left) || std::isnan(right))
+                {
+                    return true;
+                }
+                switch (operation)
+                {
+                    case Token::Less: return left < right;
+                    case Token::LessEqual: return left <= right;
+                    case Token::Greater: return left > right;
+                    case Token::GreaterEqual: return left >= right;
+                    case Token::Equal: return left == right;
+                    default: return left != right;
+                }
+            }
+            // 'bool' compares unsigned, as 0 and 1, the integers signed.
+            std::int64_t left = integer(lhs);
+            std::int64_t right = integer(rhs);
+            switch (operation)
+            {
+                case Token::Less: return left < right;
+                case Token::LessEqual: return left <= right;
+                case Token::Greater: return left > right;
+                case Token::GreaterEqual: return left >= right;
+                case Token::Equal: return left == right;
+                default: return left != right;
+            }
+        }
+        default: break;
+    }
+
+    if (isFloatingPoint(type))
+    {
+        double left = std::get<double>(lhs);
+        double right = std::get<double>(rhs);
+        switch (operation)
+        {
+            case Token::Plus: return round(left + right, type);
+            case Token::Minus: return round(left - right, type);
+            case Token::Times: return round(left * right, type);
+            default: return round(left / right, type);
+        }
+    }
+    auto left = static_cast<std::uint64_t>(std::get<std::int64_t>(lhs));
+    auto right = static_cast<std::uint64_t>(std::get<std::int64_t>(rhs));
+    switch (operation)
+    {
+        case Token::Plus: return wrap(left + right, type);
+        case Token::Minus: return wrap(left - right, type);
+        case Token::Times: return wrap(left * right, type);
+        default:
+        {
+            // Division by zero and the one overflowing division are undefined.
+            auto dividend = static_cast<std::int64_t>(left);
+            auto divisor = static_cast<std::int64_t>(right);
+            if (divisor == 0 || (divisor == -1 && dividend == wrap(std::uint64_t{1} << (bitWidth(type) - 1), type)))
+            {
+                throw Unevaluable{};
+            }
+            return dividend / divisor;
+        }
+    }
+}
+
+class Interpreter
+{
+    const EvaluationLimits& m_limits;
+    const FunctionAnalysis& m_analysis;
+    /// Variables initialized with a constant and never assigned.
+    std::unordered_map<const VarDecl*, Value> m_constants;
+
+    using CallKey = std::pair<const Function*, std::vector<std::uint64_t>>;
+    std::map<CallKey, Value> m_results;
+    /// Calls that could not be folded before, which are not tried again.
+    std::set<CallKey> m_failures;
+
+    std::size_t m_steps = 0;
+    /// Steps taken across all evaluations, see 'EvaluationLimits::maxTotalSteps'.
+    std::size_t m_totalSteps = 0;
+    std::size_t m_depth = 0;
+
+    static constexpr std::size_t NOT_EXPANDED = -1;
+
+    struct Work
+    {
+        const Expression* expression;
+        /// Number of operands, whose values are on top of 'm_values' once it is this 'Work's turn, or 'NOT_EXPANDED'
+        /// if they have not been pushed yet.
+        std::size_t operandCount;
+    };
+    std::vector<Work> m_work;
+    std::vector<Value> m_values;
+
+    void step()
+    {
+        if (++m_steps > m_limits.maxSteps || ++m_totalSteps > m_limits.maxTotalSteps)
+        {
+            throw Unevaluable{};
+        }
+    }
+
+    /// Called before every floating point operation.
+    void floatingPoint() const
+    {
+        if (!m_limits.floatingPoint)
+        {
+            throw Unevaluable{};
+        }
+    }
+
+    static CallKey key(const Function& function, const std::vector<Value>& arguments)
+    {
+        CallKey result{&function, {}};
+        for (auto& iter : arguments)
+        {
+            std::uint64_t bits;
+            if (auto* floating = std::get_if<double>(&iter))
+            {
+                std::memcpy(&bits, floating, sizeof(bits));
+            }
+            else
+            {
+                bits = static_cast<std::uint64_t>(integer(iter));
+            }
+            result.second.push_back(bits);
+        }
+        return result;
+    }
+
+    /// Evaluates 'expression', reading variables from 'frame', indexed by 'VarDecl::slot', or only constant variables
+    /// if 'frame' is null. Works through the expression with an explicit stack, like 'Codegen' does. The stacks are
+    /// shared with the evaluations of the calls within 'expression', which only ever push above the current top.
+    Value evaluate(const Expression& expression, const std::vector<Value>* frame)
+    {
+        std::size_t workBase = m_work.size();
+        std::size_t valueBase = m_values.size();
+        m_work.push_back({&expression, NOT_EXPANDED});
+        while (m_work.size() != workBase)
+        {
+            auto [current, operandCount] = m_work.back();
+            m_work.pop_back();
+            if (operandCount == NOT_EXPANDED)
+            {
+                if (isVector(current->type))
+                {
+                    throw Unevaluable{};
+                }
+                std::size_t first = m_work.size() + 1;
+                m_work.push_back({current, 0});
+                forEachOperand(*current,
+                               [&](const Expression& operand) { m_work.push_back({&operand, NOT_EXPANDED}); });
+                m_work[first - 1].operandCount = m_work.size() - first;
+                std::reverse(m_work.begin() + static_cast<std::ptrdiff_t>(first), m_work.end());
+                continue;
+            }
+            step();
+            std::size_t operands = m_values.size() - operandCount;
+            Value result = apply(*current, operands, frame);
+            m_values.resize(operands);
+            m_values.push_back(result);
+        }
+        Value result = m_values.back();
+        m_values.resize(valueBase);
+        return result;
+    }
+
+    /// Evaluates the operation of 'expression' itself, given the values of its operands, which are on top of
+    /// 'm_values' starting at index 'operands'.
+    Value apply(const Expression& expression, std::size_t operands, const std::vector<Value>* frame)
+    {
+        if (auto* atom = dynamic_cast<const Atom*>(&expression))
+        {
+            if (auto* integer = std::get_if<std::int64_t>(&atom->valueOrVar))
+            {
+                return wrap(static_cast<std::uint64_t>(*integer), expression.type);
+            }
+            if (auto* floating = std::get_if<double>(&atom->valueOrVar))
+            {
+                return round(*floating, expression.type);
+            }
+            if (auto* truthValue = std::get_if<bool>(&atom->valueOrVar))
+            {
+                return *truthValue;
+            }
+            auto* variable = std::get<VarDecl*>(atom->valueOrVar);
+            if (frame)
+            {
+                return (*frame)[variable->slot];
+            }
+            auto constant = m_constants.find(variable);
+            if (constant == m_constants.end())
+            {
+                throw Unevaluable{};
+            }
+            return constant->second;
+        }
+        if (auto* cast = dynamic_cast<const CastExpression*>(&expression))
+        {
+            return convert(m_values[operands], cast->type);
+        }
+        if (dynamic_cast<const NegateExpression*>(&expression))
+        {
+            if (auto* floating = std::get_if<double>(&m_values[operands]))
+            {
+                floatingPoint();
+                return -*floating;
+            }
+            return wrap(std::uint64_t{0} - static_cast<std::uint64_t>(std::get<std::int64_t>(m_values[operands])),
+                        expression.type);
+        }
+        if (auto* call = dynamic_cast<const CallExpression*>(&expression))
+        {
+            auto first = m_values.begin() + static_cast<std::ptrdiff_t>(operands);
+            return this->call(*call->function, {first, m_values.end()});
+        }
+        if (auto* binary = dynamic_cast<const BinaryExpression*>(&expression))
+        {
+            if (isFloatingPoint(binary->lhs->type))
+            {
+                floatingPoint();
+            }
+            return ::binary(binary->operation, binary->lhs->type, binary->type, m_values[operands],
+                            m_values[operands + 1]);
+        }
+        throw Unevaluable{};
+    }
+
+    Value call(const Function& function, std::vector<Value>&& arguments)
+    {
+        if (function.external || !m_analysis.get(function).noMemoryEffects)
+        {
+            throw Unevaluable{};
+        }
+        auto callKey = key(function, arguments);
+        if (auto result = m_results.find(callKey); result != m_results.end())
+        {
+            return result->second;
+        }
+        if (++m_depth > m_limits.maxDepth)
+        {
+            throw Unevaluable{};
+        }
+        std::vector<Value> frame(function.slotCount);
+        for (std::size_t i = 0; i < arguments.size(); i++)
+        {
+            frame[function.parameters[i]->slot] = std::move(arguments[i]);
+        }
+        auto result = execute(function.body, frame);
+        // Falling off the end of a function is undefined.
+        if (!result)
+        {
+            throw Unevaluable{};
+        }
+        m_depth--;
+        m_results.emplace(std::move(callKey), *result);
+        return *result;
+    }
+
+    /// Runs 'statements', returning the value of the 'return' statement reached, if any.
+    std::optional<Value> execute(const std::vector<Statement>& statements, std::vector<Value>& frame)
+    {
+        for (auto& iter : statements)
+        {
+            step();
+            if (auto* ret = std::get_if<Statement::ReturnStatement>(&iter.variant))
+            {
+                return evaluate(*ret->expression, &frame);
+            }
+            if (auto* expr = std::get_if<std::unique_ptr<Expression>>(&iter.variant))
+            {
+                evaluate(**expr, &frame);
+            }
+            else if (auto* varDecl = std::get_if<std::unique_ptr<VarDecl>>(&iter.variant))
+            {
+                const auto& variable = **varDecl;
+                if (isVector(variable.type))
+                {
+                    throw Unevaluable{};
+                }
+                frame[variable.slot] = variable.initializer ? evaluate(*variable.initializer, &frame)
+                                                            : convert(std::int64_t{0}, variable.type);
+            }
+            else if (auto* assignment = std::get_if<Statement::Assignment>(&iter.variant))
+            {
+                frame[assignment->variable->slot] = evaluate(*assignment->value, &frame);
+            }
+            else if (auto* ifStmt = std::get_if<Statement::IfStatement>(&iter.variant))
+            {
+                if (std::get<bool>(evaluate(*ifStmt->condition, &frame)))
+                {
+                    if (auto result = execute(ifStmt->body, frame))
+                    {
+                        return result;
+                    }
+                }
+            }
+            else if (auto* whileStmt = std::get_if<Statement::WhileStatement>(&iter.variant))
+            {
+                while (std::get<bool>(evaluate(*whileStmt->condition, &frame)))
+                {
+                    if (auto result = execute(whileStmt->body, frame))
+                    {
+                        return result;
+                    }
+                }
+            }
+            else
+            {
+                throw Unevaluable{};
+            }
+        }
+        return std::nullopt;
+    }
+
+public:
+    Interpreter(const EvaluationLimits& limits, const FunctionAnalysis& analysis)
+        : m_limits(limits), m_analysis(analysis)
+    {
+    }
+
+    /// Evaluates 'expression' if it is constant.
+    std::optional<Value> tryEvaluate(const Expression& expression)
+    {
+        m_steps = 0;
+        m_depth = 0;
+        m_work.clear();
+        m_values.clear();
+        try
+        {
+            return evaluate(expression, nullptr);
+        }
+        catch (const Unevaluable&)
+        {
+            return std::nullopt;
+        }
+    }
+
+    /// Evaluates 'call' if its arguments are constant, storing their values in 'arguments'.
+    std::optional<Value> tryCall(const CallExpression& call, std::vector<Value>& arguments)
+    {
+        arguments.clear();
+        for (auto& iter : call.arguments)
+        {
+            auto argument = tryEvaluate(*iter);
+            if (!argument)
+            {
+                return std::nullopt;
+            }
+            arguments.push_back(*argument);
+        }
+        auto callKey = key(*call.function, arguments);
+        if (m_failures.count(callKey))
+        {
+            return std::nullopt;
+        }
+        m_steps = 0;
+        m_depth = 0;
+        m_work.clear();
+        m_values.clear();
+        try
+        {
+            return this->call(*call.function, std::vector<Value>(arguments));
+        }
+        catch (const Unevaluable&)
+        {
+            m_failures.insert(std::move(callKey));
+            return std::nullopt;
+        }
+    }
+
+    void addConstant(const VarDecl& variable, Value value)
+    {
+        m_constants.emplace(&variable, value);
+    }
+};
+
+std::string toString(const Value& value)
+{
+    if (auto* truthValue = std::get_if<bool>(&value))
+    {
+        return *truthValue ? "true" : "false";
+    }
+    if (auto* integer = std::get_if<std::int64_t>(&value))
+    {
+        return std::to_string(*integer);
+    }
+    char buffer[32];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), std::get<double>(value));
+    std::string text(buffer, result.ptr);
+    // Keep integral values recognizable as floating point, e.g. "3.0" rather than "3".
+    if (text.find_first_not_of("-0123456789") == std::string::npos)
+    {
+        text += ".0";
+    }
+    return text;
+}
+
+/// Calls 'f' with the owning pointer of every operand of 'expression', allowing them to be replaced.
+template <class F>
+void forEachOperandSlot(Expression& expression, F&& f)
+{
+    if (auto* binary = dynamic_cast<BinaryExpression*>(&expression))
+    {
+        f(binary->lhs);
+        f(binary->rhs);
+    }
+    else if (auto* negate = dynamic_cast<NegateExpression*>(&expression))
+    {
+        f(negate->operand);
+    }
+    else if (auto* cast = dynamic_cast<CastExpression*>(&expression))
+    {
+        f(cast->operand);
+    }
+    else if (auto* call = dynamic_cast<CallExpression*>(&expression))
+    {
+        for (auto& iter : call->arguments)
+        {
+            f(iter);
+        }
+    }
+    else if (auto* builtin = dynamic_cast<BuiltinExpression*>(&expression))
+    {
+        for (auto& iter : builtin->arguments)
+        {
+            f(iter);
+        }
+    }
+}
+
+class Folder
+{
+    Interpreter& m_interpreter;
+    std::vector<FoldedCall>* m_report;
+    /// Variables of the current function that are assigned anywhere.
+    std::unordered_set<const VarDecl*> m_assigned;
+
+    void collectAssigned(const std::vector<Statement>& statements)
+    {
+        for (auto& iter : statements)
+        {
+            if (auto* assignment = std::get_if<Statement::Assignment>(&iter.variant))
+            {
+                m_assigned.insert(assignment->variable);
+            }
+            else if (auto* ifStmt = std::get_if<Statement::IfStatement>(&iter.variant))
+            {
+                collectAssigned(ifStmt->body);
+            }
+            else if (auto* whileStmt = std::get_if<Statement::WhileStatement>(&iter.variant))
+            {
+                collectAssigned(whileStmt->body);
+            }
+            else if (auto* parallelFor = std::get_if<Statement::ParallelFor>(&iter.variant))
+            {
+                for (auto& reduction : parallelFor->reductions)
+                {
+                    m_assigned.insert(reduction.variable);
+                }
+                collectAssigned(parallelFor->body);
+            }
+        }
+    }
+
+    /// Folds the outermost constant calls within 'expression'.
+    void fold(std::unique_ptr<Expression>& expression, std::size_t line)
+    {
+        std::vector<std::unique_ptr<Expression>*> work{&expression};
+        std::vector<Value> arguments;
+        while (!work.empty())
+        {
+            auto* slot = work.back();
+            work.pop_back();
+            if (auto* call = dynamic_cast<const CallExpression*>(slot->get()))
+            {
+                if (auto value = m_interpreter.tryCall(*call, arguments))
+                {
+                    if (m_report)
+                    {
+                        std::string text = call->function->identifier + "(";
+                        for (std::size_t i = 0; i < arguments.size(); i++)
+                        {
+                            text += (i == 0 ? "" : ", ") + toString(arguments[i]);
+                        }
+                        m_report->push_back({line, text + ")", toString(*value)});
+                    }
+                    Type type = call->type;
+                    *slot = std::make_unique<Atom>(type, std::visit([](auto iter) -> Atom::Variant { return iter; },
+                                                                    *value));
+                    continue;
+                }
+            }
+            forEachOperandSlot(**slot, [&](std::unique_ptr<Expression>& operand) { work.push_back(&operand); });
+        }
+    }
+
+    void fold(std::vector<Statement>& statements)
+    {
+        for (auto& iter : statements)
+        {
+            if (auto* ret = std::get_if<Statement::ReturnStatement>(&iter.variant))
+            {
+                fold(ret->expression, iter.line);
+            }
+            else if (auto* expr = std::get_if<std::unique_ptr<Expression>>(&iter.variant))
+            {
+                fold(*expr, iter.line);
+            }
+            else if (auto* varDecl = std::get_if<std::unique_ptr<VarDecl>>(&iter.variant))
+            {
+                auto& variable = **varDecl;
+                if (!variable.initializer)
+                {
+                    continue;
+                }
+                fold(variable.initializer, iter.line);
+                if (!m_assigned.count(&variable))
+                {
+                    if (auto value = m_interpreter.tryEvaluate(*variable.initializer))
+                    {
+                        m_interpreter.addConstant(variable, *value);
+                    }
+                }
+            }
+            else if (auto* assignment = std::get_if<Statement::Assignment>(&iter.variant))
+            {
+                fold(assignment->value, iter.line);
+            }
+            else if (auto* ifStmt = std::get_if<Statement::IfStatement>(&iter.variant))
+            {
+                fold(ifStmt->condition, iter.line);
+                fold(ifStmt->body);
+            }
+            else if (auto* whileStmt = std::get_if<Statement::WhileStatement>(&iter.variant))
+            {
+                fold(whileStmt->condition, iter.line);
+                fold(whileStmt->body);
+            }
+            else if (auto* parallelFor = std::get_if<Statement::ParallelFor>(&iter.variant))
+            {
+                fold(parallelFor->begin, iter.line);
+                fold(parallelFor->end, iter.line);
+                fold(parallelFor->body);
+            }
+        }
+    }
+
+public:
+    Folder(Interpreter& interpreter, std::vector<FoldedCall>* report) : m_interpreter(interpreter), m_report(report) {}
+
+    void fold(Function& function)
+    {
+        m_assigned.clear();
+        collectAssigned(function.body);
+        fold(function.body);
+    }
+};
+
+} // namespace
+
+void foldConstantCalls(File& file, const EvaluationLimits& limits, std::vector<FoldedCall>* report)
+{
+    FunctionAnalysis analysis;
+    Interpreter interpreter(limits, analysis);
+    Folder folder(interpreter, report);
+    for (auto& iter : file.functions)
+    {
+        analysis.analyze(*iter);
+        if (!iter->external)
+        {
+            folder.fold(*iter);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "Syntax.hpp"
+
+/// A call replaced by its result by 'foldConstantCalls'.
+struct FoldedCall
+{
+    /// Line of the statement containing the call.
+    std::size_t line;
+    /// The call with its arguments evaluated, e.g. "fib(30)".
+    std::string call;
+    std::string value;
+};
+
+struct EvaluationLimits
+{
+    /// Statements and expressions evaluated per folded call, including those of the functions it calls.
+    std::size_t maxSteps = 1'000'000;
+    /// Statements and expressions evaluated for the whole file, including by calls that could not be folded. Once it
+    /// is exhausted, no further calls are folded, bounding the time spent on a file regardless of how many calls it
+    /// contains.
+    std::size_t maxTotalSteps = 10'000'000;
+    /// Maximum depth of nested calls.
+    std::size_t maxDepth = 256;
+    /// Evaluate floating point arithmetic and comparisons, following strict IEEE 754 semantics. Must be false if the
+    /// generated code may deviate from them, i.e. with any of 'CodegenOptions::fastMath' set.
+    bool floatingPoint = true;
+};
+
+/// Replaces every call of a function without memory effects whose arguments are constant by the value it returns,
+/// computed by interpreting the function's syntax tree. Arguments are constant if they consist of literals, of calls
+/// folded this way, and of variables initialized with a constant and never assigned.
+///
+/// The interpreter follows the semantics of the generated code bit for bit, taking floating point to be strict IEEE 754
+/// arithmetic without contraction. Calls performing floating point operations are therefore only folded with
+/// 'EvaluationLimits::floatingPoint' set. Calls are also left alone if evaluating them exceeds 'limits' or runs into
+/// anything the generated code does not define, like a division by zero or a conversion of an out of range 'double'
+/// to an integer. Calls involving vectors, 'parallel for' or 'extern' functions are never folded. Results of calls are
+/// memoized, so recursive functions like 'fib' take a step per distinct argument.
+///
+/// Every folded call is appended to 'report' unless it is null.
+void foldConstantCalls(File& file, const EvaluationLimits& limits = {}, std::vector<FoldedCall>* report = nullptr);
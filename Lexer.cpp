@@ -1,74 +1,73 @@
 #include "Lexer.hpp"
 
-#include <iostream>
+#include <stdexcept>
 
-std::vector<Token> tokenize(std::string_view source)
+#include "Error.hpp"
+
+Token Lexer::make(Token::TokenType type, Token::Variant variant) const
 {
-    std::vector<Token> result;
-    auto curr = source.begin();
-    while (curr != source.end())
+    Token token(type, std::move(variant));
+    token.line = m_line;
+    return token;
+}
+
+std::optional<Token> Lexer::next()
+{
+    while (m_curr != m_end)
     {
-        auto character = *curr;
-        curr++;
+        auto character = *m_curr;
+        m_curr++;
         switch (character)
         {
-            case ',': result.emplace_back(Token::Comma); break;
-            case ':': result.emplace_back(Token::Colon); break;
-            case ';': result.emplace_back(Token::SemiColon); break;
-            case '+': result.emplace_back(Token::Plus); break;
-            case '-': result.emplace_back(Token::Minus); break;
-            case '*': result.emplace_back(Token::Times); break;
-            case '/': result.emplace_back(Token::Divide); break;
-            case '(': result.emplace_back(Token::OpenParen); break;
-            case ')': result.emplace_back(Token::CloseParen); break;
-            case '{': result.emplace_back(Token::OpenBrace); break;
-            case '}': result.emplace_back(Token::CloseBrace); break;
+            case ',': return make(Token::Comma);
+            case ':': return make(Token::Colon);
+            case ';': return make(Token::SemiColon);
+            case '+': return make(Token::Plus);
+            case '-': return make(Token::Minus);
+            case '*': return make(Token::Times);
+            case '/': return make(Token::Divide);
+            case '(': return make(Token::OpenParen);
+            case ')': return make(Token::CloseParen);
+            case '{': return make(Token::OpenBrace);
+            case '}': return make(Token::CloseBrace);
             case '!':
             {
-                if (curr != source.end() && *curr == '=')
+                if (m_curr != m_end && *m_curr == '=')
                 {
-                    curr++;
-                    result.emplace_back(Token::NotEqual);
-                    break;
+                    m_curr++;
+                    return make(Token::NotEqual);
                 }
-                std::cerr << "Unknown token: !";
-                std::abort();
+                throw CompileError("error: Unknown token: !");
             }
             case '<':
             {
-                if (curr != source.end() && *curr == '=')
+                if (m_curr != m_end && *m_curr == '=')
                 {
-                    curr++;
-                    result.emplace_back(Token::LessEqual);
-                    break;
+                    m_curr++;
+                    return make(Token::LessEqual);
                 }
-                result.emplace_back(Token::Less);
-                break;
+                return make(Token::Less);
             }
             case '>':
             {
-                if (curr != source.end() && *curr == '=')
+                if (m_curr != m_end && *m_curr == '=')
                 {
-                    curr++;
-                    result.emplace_back(Token::GreaterEqual);
-                    break;
+                    m_curr++;
+                    return make(Token::GreaterEqual);
                 }
-                result.emplace_back(Token::Greater);
-                break;
+                return make(Token::Greater);
             }
             case '=':
             {
-                if (curr != source.end() && *curr == '=')
+                if (m_curr != m_end && *m_curr == '=')
                 {
-                    curr++;
-                    result.emplace_back(Token::Equal);
-                    break;
+                    m_curr++;
+                    return make(Token::Equal);
                 }
-                result.emplace_back(Token::Assignment);
-                break;
+                return make(Token::Assignment);
             }
+            case '\n': m_line++; break;
             case ' ':
-            case '\n':
             case '\t':
             case '\r': break;
             default:
@@ -77,87 +76,175 @@ std::vector<Token> tokenize(std::string_view source)
                 {
                     std::string value;
                     value += character;
-                    for (; curr != source.end() && *curr >= '0' && *curr <= '9'; curr++)
+                    for (; m_curr != m_end && *m_curr >= '0' && *m_curr <= '9'; m_curr++)
                     {
-                        value += *curr;
+                        value += *m_curr;
                     }
-                    if (curr == source.end() || *curr != '.')
+                    if (m_curr == m_end || *m_curr != '.')
                     {
-                        result.emplace_back(Token::Number, std::stoi(value));
-                        break;
+                        try
+                        {
+                            return make(Token::Number, static_cast<std::int64_t>(std::stoll(value)));
+                        }
+                        catch (const std::out_of_range&)
+                        {
+                            throw CompileError("error: Integer literal " + value + " is too large");
+                        }
                     }
                     value += '.';
-                    curr++;
-                    for (; curr != source.end() && *curr >= '0' && *curr <= '9'; curr++)
+                    m_curr++;
+                    for (; m_curr != m_end && *m_curr >= '0' && *m_curr <= '9'; m_curr++)
                     {
-                        value += *curr;
+                        value += *m_curr;
                     }
-                    result.emplace_back(Token::Number, std::stod(value));
-                    break;
+                    return make(Token::Decimal, std::stod(value));
                 }
                 if ((character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z'))
                 {
                     std::string value;
                     value += character;
-                    for (; curr != source.end() && (*curr >= 'a' && *curr <= 'z') || (*curr >= 'A' && *curr <= 'Z');
-                         curr++)
+                    for (; m_curr != m_end
+                           && ((*m_curr >= 'a' && *m_curr <= 'z') || (*m_curr >= 'A' && *m_curr <= 'Z')
+                               || (*m_curr >= '0' && *m_curr <= '9') || *m_curr == '_');
+                         m_curr++)
                     {
-                        value += *curr;
+                        value += *m_curr;
                     }
                     if (value == "int")
                     {
-                        result.emplace_back(Token::IntKeyword);
+                        return make(Token::IntKeyword);
+                    }
+                    else if (value == "i8")
+                    {
+                        return make(Token::I8Keyword);
+                    }
+                    else if (value == "i16")
+                    {
+                        return make(Token::I16Keyword);
+                    }
+                    else if (value == "i64")
+                    {
+                        return make(Token::I64Keyword);
+                    }
+                    else if (value == "float")
+                    {
+                        return make(Token::FloatKeyword);
+                    }
+                    else if (value == "bool")
+                    {
+                        return make(Token::BoolKeyword);
+                    }
+                    else if (value == "vec2")
+                    {
+                        return make(Token::Vec2Keyword);
+                    }
+                    else if (value == "vec4")
+                    {
+                        return make(Token::Vec4Keyword);
+                    }
+                    else if (value == "vec8")
+                    {
+                        return make(Token::Vec8Keyword);
+                    }
+                    else if (value == "true")
+                    {
+                        return make(Token::TrueKeyword);
+                    }
+                    else if (value == "false")
+                    {
+                        return make(Token::FalseKeyword);
                     }
                     else if (value == "double")
                     {
-                        result.emplace_back(Token::DoubleKeyword);
+                        return make(Token::DoubleKeyword);
                     }
                     else if (value == "fun")
                     {
-                        result.emplace_back(Token::FunKeyword);
+                        return make(Token::FunKeyword);
+                    }
+                    else if (value == "extern")
+                    {
+                        return make(Token::ExternKeyword);
+                    }
+                    else if (value == "export")
+                    {
+                        return make(Token::ExportKeyword);
                     }
                     else if (value == "if")
                     {
-                        result.emplace_back(Token::IfKeyword);
+                        return make(Token::IfKeyword);
                     }
                     else if (value == "for")
                     {
-                        result.emplace_back(Token::ForKeyword);
+                        return make(Token::ForKeyword);
+                    }
+                    else if (value == "parallel")
+                    {
+                        return make(Token::ParallelKeyword);
+                    }
+                    else if (value == "reduce")
+                    {
+                        return make(Token::ReduceKeyword);
                     }
                     else if (value == "while")
                     {
-                        result.emplace_back(Token::WhileKeyword);
+                        return make(Token::WhileKeyword);
+                    }
+                    else if (value == "likely")
+                    {
+                        return make(Token::LikelyKeyword);
+                    }
+                    else if (value == "unlikely")
+                    {
+                        return make(Token::UnlikelyKeyword);
+                    }
+                    else if (value == "unroll")
+                    {
+                        return make(Token::UnrollKeyword);
+                    }
+                    else if (value == "vectorize")
+                    {
+                        return make(Token::VectorizeKeyword);
                     }
                     else if (value == "var")
                     {
-                        result.emplace_back(Token::VarKeyword);
+                        return make(Token::VarKeyword);
                     }
                     else if (value == "as")
                     {
-                        result.emplace_back(Token::AsKeyword);
+                        return make(Token::AsKeyword);
                     }
                     else if (value == "or")
                     {
-                        result.emplace_back(Token::OrKeyword);
+                        return make(Token::OrKeyword);
                     }
                     else if (value == "and")
                     {
-                        result.emplace_back(Token::AndKeyword);
+                        return make(Token::AndKeyword);
                     }
                     else if (value == "return")
                     {
-                        result.emplace_back(Token::ReturnKeyword);
+                        return make(Token::ReturnKeyword);
                     }
                     else
                     {
-                        result.emplace_back(Token::Identifier, std::move(value));
+                        return make(Token::Identifier, std::move(value));
                     }
-                    break;
                 }
-                std::cerr << "Unexpected character: " << character;
-                std::abort();
+                throw CompileError(std::string("error: Unexpected character: ") + character);
             }
         }
     }
+    return std::nullopt;
+}
+
+std::vector<Token> tokenize(std::string_view source)
+{
+    std::vector<Token> result;
+    Lexer lexer(source);
+    while (auto token = lexer.next())
+    {
+        result.push_back(std::move(*token));
+    }
     return result;
 }
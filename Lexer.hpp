@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <variant>
@@ -11,11 +13,29 @@ struct Token
     {
         IntKeyword,
         DoubleKeyword,
+        I8Keyword,
+        I16Keyword,
+        I64Keyword,
+        FloatKeyword,
+        BoolKeyword,
+        Vec2Keyword,
+        Vec4Keyword,
+        Vec8Keyword,
+        TrueKeyword,
+        FalseKeyword,
         FunKeyword,
+        ExternKeyword,
+        ExportKeyword,
         ReturnKeyword,
         IfKeyword,
         ForKeyword,
+        ParallelKeyword,
+        ReduceKeyword,
         WhileKeyword,
+        LikelyKeyword,
+        UnlikelyKeyword,
+        UnrollKeyword,
+        VectorizeKeyword,
         VarKeyword,
         AsKeyword,
         OrKeyword,
@@ -43,10 +63,30 @@ struct Token
         Number
     };
     TokenType tokenType;
-    using Variant = std::variant<std::monostate, double, int, std::string>;
+    using Variant = std::variant<std::monostate, double, std::int64_t, std::string>;
     Variant variant;
+    /// Line the token is on, starting at 1.
+    std::size_t line = 0;
 
     explicit Token(TokenType tokenType, Variant variant = {}) : tokenType(tokenType), variant(variant) {}
 };
 
+/// Splits source code into tokens, one at a time.
+class Lexer
+{
+    std::string_view::const_iterator m_curr;
+    std::string_view::const_iterator m_end;
+    std::size_t m_line = 1;
+
+    Token make(Token::TokenType type, Token::Variant variant = {}) const;
+
+public:
+    explicit Lexer(std::string_view source) : m_curr(source.begin()), m_end(source.end()) {}
+
+    /// Returns the next token, or an empty optional once the end of the source is reached. Throws 'CompileError' on
+    /// characters that do not form a token.
+    std::optional<Token> next();
+};
+
+/// Returns all tokens of 'source'.
 std::vector<Token> tokenize(std::string_view source);
@@ -1,7 +1,11 @@
 
 #include "Parser.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "Error.hpp"
 
 File Parser::parseFile()
 {
@@ -15,49 +19,75 @@ File Parser::parseFile()
 
 namespace
 {
-struct Stream
+class Stream
 {
-    [[noreturn]] ~Stream()
+    std::ostringstream m_message;
+
+public:
+    explicit Stream(std::string_view text)
     {
-        std::abort();
+        m_message << "error: " << text;
+    }
+
+    [[nodiscard]] std::string str() const
+    {
+        return m_message.str();
     }
 
     Stream& operator<<(Token::TokenType type)
     {
         switch (type)
         {
-            case Token::IntKeyword: std::cerr << "'int'"; break;
-            case Token::DoubleKeyword: std::cerr << "'double'"; break;
-            case Token::FunKeyword: std::cerr << "'fun'"; break;
-            case Token::IfKeyword: std::cerr << "'if'"; break;
-            case Token::ForKeyword: std::cerr << "'for'"; break;
-            case Token::WhileKeyword: std::cerr << "'while'"; break;
-            case Token::ReturnKeyword: std::cerr << "'return'"; break;
-            case Token::VarKeyword: std::cerr << "'var'"; break;
-            case Token::AsKeyword: std::cerr << "'as'"; break;
-            case Token::OrKeyword: std::cerr << "'or'"; break;
-            case Token::AndKeyword: std::cerr << "'and'"; break;
-            case Token::OpenParen: std::cerr << "'('"; break;
-            case Token::CloseParen: std::cerr << "')'"; break;
-            case Token::OpenBrace: std::cerr << "'{'"; break;
-            case Token::CloseBrace: std::cerr << "'}'"; break;
-            case Token::Comma: std::cerr << "','"; break;
-            case Token::Colon: std::cerr << "':'"; break;
-            case Token::SemiColon: std::cerr << "';'"; break;
-            case Token::Assignment: std::cerr << "'='"; break;
-            case Token::Less: std::cerr << "'<'"; break;
-            case Token::Greater: std::cerr << "'>'"; break;
-            case Token::LessEqual: std::cerr << "'<='"; break;
-            case Token::GreaterEqual: std::cerr << "'>='"; break;
-            case Token::Equal: std::cerr << "'=='"; break;
-            case Token::NotEqual: std::cerr << "'!='"; break;
-            case Token::Plus: std::cerr << "'+'"; break;
-            case Token::Minus: std::cerr << "'-'"; break;
-            case Token::Times: std::cerr << "'*'"; break;
-            case Token::Divide: std::cerr << "'/'"; break;
-            case Token::Identifier: std::cerr << "identifier"; break;
-            case Token::Decimal: std::cerr << "decimal"; break;
-            case Token::Number: std::cerr << "number"; break;
+            case Token::IntKeyword: m_message << "'int'"; break;
+            case Token::DoubleKeyword: m_message << "'double'"; break;
+            case Token::I8Keyword: m_message << "'i8'"; break;
+            case Token::I16Keyword: m_message << "'i16'"; break;
+            case Token::I64Keyword: m_message << "'i64'"; break;
+            case Token::FloatKeyword: m_message << "'float'"; break;
+            case Token::BoolKeyword: m_message << "'bool'"; break;
+            case Token::Vec2Keyword: m_message << "'vec2'"; break;
+            case Token::Vec4Keyword: m_message << "'vec4'"; break;
+            case Token::Vec8Keyword: m_message << "'vec8'"; break;
+            case Token::TrueKeyword: m_message << "'true'"; break;
+            case Token::FalseKeyword: m_message << "'false'"; break;
+            case Token::FunKeyword: m_message << "'fun'"; break;
+            case Token::ExternKeyword: m_message << "'extern'"; break;
+            case Token::ExportKeyword: m_message << "'export'"; break;
+            case Token::IfKeyword: m_message << "'if'"; break;
+            case Token::ForKeyword: m_message << "'for'"; break;
+            case Token::ParallelKeyword: m_message << "'parallel'"; break;
+            case Token::ReduceKeyword: m_message << "'reduce'"; break;
+            case Token::WhileKeyword: m_message << "'while'"; break;
+            case Token::LikelyKeyword: m_message << "'likely'"; break;
+            case Token::UnlikelyKeyword: m_message << "'unlikely'"; break;
+            case Token::UnrollKeyword: m_message << "'unroll'"; break;
+            case Token::VectorizeKeyword: m_message << "'vectorize'"; break;
+            case Token::ReturnKeyword: m_message << "'return'"; break;
+            case Token::VarKeyword: m_message << "'var'"; break;
+            case Token::AsKeyword: m_message << "'as'"; break;
+            case Token::OrKeyword: m_message << "'or'"; break;
+            case Token::AndKeyword: m_message << "'and'"; break;
+            case Token::OpenParen: m_message << "'('"; break;
+            case Token::CloseParen: m_message << "')'"; break;
+            case Token::OpenBrace: m_message << "'{'"; break;
+            case Token::CloseBrace: m_message << "'}'"; break;
+            case Token::Comma: m_message << "','"; break;
+            case Token::Colon: m_message << "':'"; break;
+            case Token::SemiColon: m_message << "';'"; break;
+            case Token::Assignment: m_message << "'='"; break;
+            case Token::Less: m_message << "'<'"; break;
+            case Token::Greater: m_message << "'>'"; break;
+            case Token::LessEqual: m_message << "'<='"; break;
+            case Token::GreaterEqual: m_message << "'>='"; break;
+            case Token::Equal: m_message << "'=='"; break;
+            case Token::NotEqual: m_message << "'!='"; break;
+            case Token::Plus: m_message << "'+'"; break;
+            case Token::Minus: m_message << "'-'"; break;
+            case Token::Times: m_message << "'*'"; break;
+            case Token::Divide: m_message << "'/'"; break;
+            case Token::Identifier: m_message << "identifier"; break;
+            case Token::Decimal: m_message << "decimal"; break;
+            case Token::Number: m_message << "number"; break;
         }
         return *this;
     }
@@ -65,15 +95,54 @@ struct Stream
     template <class T>
     Stream& operator<<(const T& value)
     {
-        std::cerr << value;
+        m_message << value;
         return *this;
     }
 };
 
-Stream error(std::string_view text)
+/// Throws a 'CompileError' whose message is 'text' followed by 'args', formatted by 'Stream'.
+template <class... Args>
+[[noreturn]] void error(std::string_view text, const Args&... args)
+{
+    Stream stream(text);
+    ((stream << args), ...);
+    throw CompileError(stream.str());
+}
+
+/// Implicitly or explicitly converts 'expression' to 'type'. Scalars convert to vectors by broadcasting, but vectors
+/// only convert to vectors of the same number of lanes.
+void convert(std::unique_ptr<Expression>& expression, Type type)
+{
+    if (expression->type == type)
+    {
+        return;
+    }
+    if (isVector(expression->type) && laneCount(expression->type) != laneCount(type))
+    {
+        error(isVector(type) ? "Cannot convert between vectors of different lane counts"
+                             : "Cannot convert a vector to a scalar");
+    }
+    expression = std::make_unique<CastExpression>(type, std::move(expression));
+}
+
+/// Converts the operand of lower 'conversionRank' to the type of the other and returns the resulting type. If either
+/// operand is a vector, so is the result, with lanes of the higher ranked of the two lane types.
+Type commonType(std::unique_ptr<Expression>& lhs, std::unique_ptr<Expression>& rhs)
 {
-    std::cerr << "error: " << text;
-    return {};
+    Type type = conversionRank(lhs->type) >= conversionRank(rhs->type) ? lhs->type : rhs->type;
+    if (isVector(lhs->type) || isVector(rhs->type))
+    {
+        unsigned lanes = std::max(laneCount(lhs->type), laneCount(rhs->type));
+        auto vector = vectorType(elementType(type), lanes);
+        if (!vector)
+        {
+            error("There are no vectors of this element type");
+        }
+        type = *vector;
+    }
+    convert(lhs, type);
+    convert(rhs, type);
+    return type;
 }
 
 } // namespace
@@ -82,11 +151,11 @@ void Parser::expect(Token::TokenType type)
 {
     if (m_curr == m_end)
     {
-        error("Expected ") << type;
+        error("Expected ", type);
     }
     if (m_curr->tokenType != type)
     {
-        error("Expected ") << type << " instead of " << m_curr->tokenType;
+        error("Expected ", type, " instead of ", m_curr->tokenType);
     }
     m_curr++;
 }
@@ -95,11 +164,11 @@ std::string Parser::expectIdentifier()
 {
     if (m_curr == m_end)
     {
-        error("Expected ") << Token::Identifier;
+        error("Expected ", Token::Identifier);
     }
     if (m_curr->tokenType != Token::Identifier)
     {
-        error("Expected ") << Token::Identifier << " instead of " << m_curr->tokenType;
+        error("Expected ", Token::Identifier, " instead of ", m_curr->tokenType);
     }
     std::string result = std::get<std::string>(m_curr->variant);
     m_curr++;
@@ -110,18 +179,44 @@ Type Parser::parseType()
 {
     if (m_curr == m_end)
     {
-        error("Expected 'int' or 'double'");
+        error("Expected type");
     }
     switch (m_curr->tokenType)
     {
         case Token::DoubleKeyword: m_curr++; return Type::Double;
         case Token::IntKeyword: m_curr++; return Type::Integer;
-        default: error("Expected 'int' or 'double' instead of ") << m_curr->tokenType;
+        case Token::I8Keyword: m_curr++; return Type::Int8;
+        case Token::I16Keyword: m_curr++; return Type::Int16;
+        case Token::I64Keyword: m_curr++; return Type::Int64;
+        case Token::FloatKeyword: m_curr++; return Type::Float;
+        case Token::BoolKeyword: m_curr++; return Type::Bool;
+        case Token::Vec2Keyword:
+        case Token::Vec4Keyword:
+        case Token::Vec8Keyword:
+        {
+            unsigned lanes = m_curr->tokenType == Token::Vec2Keyword   ? 2
+                             : m_curr->tokenType == Token::Vec4Keyword ? 4
+                                                                       : 8;
+            m_curr++;
+            expect(Token::Less);
+            auto element = parseType();
+            expect(Token::Greater);
+            auto type = vectorType(element, lanes);
+            if (!type)
+            {
+                error("Vectors must have lanes of type 'int' or 'double'");
+            }
+            return *type;
+        }
+        default: error("Expected type instead of ", m_curr->tokenType);
     }
 }
 
 std::unique_ptr<Function> Parser::parseFunction()
 {
+    std::size_t line = m_curr != m_end ? m_curr->line : 0;
+    bool exported = maybeConsume(Token::ExportKeyword);
+    bool external = !exported && maybeConsume(Token::ExternKeyword);
     expect(Token::FunKeyword);
     auto name = expectIdentifier();
     expect(Token::OpenParen);
@@ -144,23 +239,249 @@ std::unique_ptr<Function> Parser::parseFunction()
     expect(Token::CloseParen);
     expect(Token::Colon);
     auto type = parseType();
+    // There is no single C calling convention for vectors.
+    if (external
+        && (isVector(type)
+            || std::any_of(parameters.begin(), parameters.end(), [](const auto& iter) { return isVector(iter->type); })))
+    {
+        error("External function ", name, " cannot take or return vectors");
+    }
     auto function = std::make_unique<Function>(std::move(name), std::move(parameters), type);
-    m_functions[function->identifier] = function.get();
-    expect(Token::OpenBrace);
+    function->index = m_functionCount++;
+    function->external = external;
+    function->exported = exported;
+    function->line = line;
+    // Erased first, as the key of a redefined function views the identifier of the previous definition.
+    m_functions.erase(function->identifier);
+    m_functions.emplace(function->identifier, function.get());
+    if (external)
+    {
+        expect(Token::SemiColon);
+        return function;
+    }
+    // Scopes of the previous function, which may have failed to parse within a loop.
     m_variables.clear();
+    m_parallelRegions.clear();
     m_currentFunc = function.get();
     for (auto& iter : function->parameters)
     {
-        m_variables[iter->identifier] = iter.get();
+        declareVariable(iter.get());
+    }
+    function->body = parseBlock();
+    return function;
+}
+
+std::unique_ptr<Function> Parser::parseExpressionFunction(std::string identifier)
+{
+    std::size_t line = m_curr != m_end ? m_curr->line : 0;
+    auto function = std::make_unique<Function>(std::move(identifier), std::vector<std::unique_ptr<VarDecl>>{},
+                                               Type::Integer);
+    function->index = m_functionCount++;
+    function->line = line;
+    m_variables.clear();
+    m_parallelRegions.clear();
+    m_currentFunc = function.get();
+    auto expression = parseExpression();
+    maybeConsume(Token::SemiColon);
+    if (m_curr != m_end)
+    {
+        error("Expected end of expression instead of ", m_curr->tokenType);
+    }
+    function->returnType = expression->type;
+    function->body.push_back({Statement::ReturnStatement{std::move(expression)}});
+    function->body.back().line = line;
+    return function;
+}
+
+void Parser::declareVariable(VarDecl* variable)
+{
+    variable->slot = m_currentFunc->slotCount++;
+    m_variables.push_back(variable);
+}
+
+void Parser::readVariable(VarDecl* variable)
+{
+    for (auto& iter : m_parallelRegions)
+    {
+        if (variable->slot >= iter.firstSlot)
+        {
+            continue;
+        }
+        auto& loop = *iter.loop;
+        bool isReduction = std::any_of(loop.reductions.begin(), loop.reductions.end(),
+                                       [&](const auto& reduction) { return reduction.variable == variable; });
+        if (!isReduction && std::find(loop.captures.begin(), loop.captures.end(), variable) == loop.captures.end())
+        {
+            loop.captures.push_back(variable);
+        }
+    }
+}
+
+void Parser::writeVariable(VarDecl* variable)
+{
+    for (auto& iter : m_parallelRegions)
+    {
+        if (variable->slot >= iter.firstSlot)
+        {
+            continue;
+        }
+        auto& loop = *iter.loop;
+        if (std::none_of(loop.reductions.begin(), loop.reductions.end(),
+                         [&](const auto& reduction) { return reduction.variable == variable; }))
+        {
+            error("Variable ", variable->identifier,
+                  " declared outside of 'parallel for' can only be assigned as a reduction");
+        }
+    }
+}
+
+Statement::ParallelFor Parser::parseParallelFor()
+{
+    expect(Token::ParallelKeyword);
+    expect(Token::ForKeyword);
+    Statement::ParallelFor loop;
+    auto name = expectIdentifier();
+    expect(Token::Assignment);
+    loop.begin = parseExpression();
+    expect(Token::Comma);
+    loop.end = parseExpression();
+    Type type = commonType(loop.begin, loop.end);
+    if (type == Type::Bool || isFloatingPoint(type) || isVector(type))
+    {
+        error("Bounds of 'parallel for' must be integers");
+    }
+
+    while (maybeConsume(Token::ReduceKeyword))
+    {
+        if (m_curr == m_end || (m_curr->tokenType != Token::Plus && m_curr->tokenType != Token::Times))
+        {
+            error("Expected '+' or '*' after 'reduce'");
+        }
+        auto operation = m_curr->tokenType;
+        m_curr++;
+        auto identifier = expectIdentifier();
+        auto* variable = lookupVariable(identifier);
+        if (!variable)
+        {
+            error("Could not reduce into unknown variable ", identifier);
+        }
+        if (variable->type == Type::Bool || isVector(variable->type))
+        {
+            error("Could not reduce into variable ", identifier, " of type 'bool' or of vector type");
+        }
+        if (std::any_of(loop.reductions.begin(), loop.reductions.end(),
+                        [&](const auto& reduction) { return reduction.variable == variable; }))
+        {
+            error("Variable ", identifier, " is reduced more than once");
+        }
+        // Every thread of enclosing loops writes to the variable as well.
+        writeVariable(variable);
+        loop.reductions.push_back({operation, variable});
+    }
+
+    std::size_t scopeStart = m_variables.size();
+    m_parallelRegions.push_back({&loop, m_currentFunc->slotCount});
+    loop.induction = std::make_unique<VarDecl>(std::move(name), type);
+    declareVariable(loop.induction.get());
+    loop.body = parseBlock();
+    m_parallelRegions.pop_back();
+    m_variables.resize(scopeStart);
+    return loop;
+}
+
+Likelihood Parser::parseLikelihood()
+{
+    if (maybeConsume(Token::LikelyKeyword))
+    {
+        return Likelihood::Likely;
+    }
+    if (maybeConsume(Token::UnlikelyKeyword))
+    {
+        return Likelihood::Unlikely;
+    }
+    return Likelihood::Unknown;
+}
+
+unsigned Parser::parseHintCount()
+{
+    if (m_curr == m_end || m_curr->tokenType != Token::Number)
+    {
+        error("Expected a count");
+    }
+    auto value = std::get<std::int64_t>(m_curr->variant);
+    if (value < 1 || value > std::numeric_limits<std::int32_t>::max())
+    {
+        error("Count ", value, " is out of range");
+    }
+    m_curr++;
+    return static_cast<unsigned>(value);
+}
+
+LoopHints Parser::parseLoopHints()
+{
+    LoopHints hints;
+    while (true)
+    {
+        if (maybeConsume(Token::UnrollKeyword))
+        {
+            hints.unroll = true;
+            if (maybeConsume(Token::OpenParen))
+            {
+                hints.unroll = false;
+                hints.unrollCount = parseHintCount();
+                expect(Token::CloseParen);
+            }
+            continue;
+        }
+        if (maybeConsume(Token::VectorizeKeyword))
+        {
+            hints.vectorize = true;
+            if (maybeConsume(Token::OpenParen))
+            {
+                do
+                {
+                    auto option = expectIdentifier();
+                    if (option != "width" && option != "interleave")
+                    {
+                        error("Expected 'width' or 'interleave' instead of ", option);
+                    }
+                    expect(Token::Assignment);
+                    (option == "width" ? hints.vectorizeWidth : hints.interleaveCount) = parseHintCount();
+                } while (maybeConsume(Token::Comma));
+                expect(Token::CloseParen);
+            }
+            continue;
+        }
+        return hints;
+    }
+}
+
+VarDecl* Parser::lookupVariable(std::string_view identifier) const
+{
+    for (auto iter = m_variables.rbegin(); iter != m_variables.rend(); iter++)
+    {
+        if ((*iter)->identifier == identifier)
+        {
+            return *iter;
+        }
     }
+    return nullptr;
+}
+
+std::vector<Statement> Parser::parseBlock()
+{
+    expect(Token::OpenBrace);
+    std::size_t scopeStart = m_variables.size();
     std::vector<Statement> statements;
     while (m_curr != m_end && m_curr->tokenType != Token::CloseBrace)
     {
+        std::size_t line = m_curr->line;
         statements.push_back(parseStatement());
+        statements.back().line = line;
     }
     expect(Token::CloseBrace);
-    function->body = std::move(statements);
-    return function;
+    m_variables.resize(scopeStart);
+    return statements;
 }
 
 Statement Parser::parseStatement()
@@ -184,57 +505,50 @@ Statement Parser::parseStatement()
             expect(Token::SemiColon);
             if (!type && !initializer)
             {
-                error("variable ") << name << " declared without a type";
+                error("variable ", name, " declared without a type");
             }
             if (!type)
             {
                 type = initializer->type;
             }
-            if (initializer && initializer->type != *type)
+            if (initializer)
             {
-                initializer = std::make_unique<CastExpression>(*type, std::move(initializer));
+                convert(initializer, *type);
             }
             auto var = std::make_unique<VarDecl>(std::move(name), *type, std::move(initializer));
-            m_variables[var->identifier] = var.get();
+            declareVariable(var.get());
             return {std::move(var)};
         }
         case Token::ReturnKeyword:
         {
+            if (!m_parallelRegions.empty())
+            {
+                error("'return' is not allowed within 'parallel for'");
+            }
             m_curr++;
             auto expression = parseExpression();
             expect(Token::SemiColon);
-            if (m_currentFunc->returnType != expression->type)
-            {
-                expression = std::make_unique<CastExpression>(m_currentFunc->returnType, std::move(expression));
-            }
+            convert(expression, m_currentFunc->returnType);
             return {Statement::ReturnStatement{std::move(expression)}};
         }
         case Token::IfKeyword:
         {
             m_curr++;
+            auto likelihood = parseLikelihood();
             auto condition = parseExpression();
-            expect(Token::OpenBrace);
-            std::vector<Statement> statements;
-            while (m_curr != m_end && m_curr->tokenType != Token::CloseBrace)
-            {
-                statements.push_back(parseStatement());
-            }
-            expect(Token::CloseBrace);
-            return {Statement::IfStatement{std::move(condition), std::move(statements)}};
+            convert(condition, Type::Bool);
+            return {Statement::IfStatement{std::move(condition), parseBlock(), likelihood}};
         }
         case Token::WhileKeyword:
         {
             m_curr++;
+            auto hints = parseLoopHints();
+            auto likelihood = parseLikelihood();
             auto condition = parseExpression();
-            expect(Token::OpenBrace);
-            std::vector<Statement> statements;
-            while (m_curr != m_end && m_curr->tokenType != Token::CloseBrace)
-            {
-                statements.push_back(parseStatement());
-            }
-            expect(Token::CloseBrace);
-            return {Statement::WhileStatement{std::move(condition), std::move(statements)}};
+            convert(condition, Type::Bool);
+            return {Statement::WhileStatement{std::move(condition), parseBlock(), likelihood, hints}};
         }
+        case Token::ParallelKeyword: return {parseParallelFor()};
         case Token::Identifier:
         {
             if (std::next(m_curr) != m_end && std::next(m_curr)->tokenType == Token::Assignment)
@@ -243,16 +557,14 @@ Statement Parser::parseStatement()
                 m_curr++;
                 auto expression = parseExpression();
                 expect(Token::SemiColon);
-                auto result = m_variables.find(identifier);
-                if (result == m_variables.end())
-                {
-                    error("Could not assign to unknown variable ") << identifier;
-                }
-                if (expression->type != result->second->type)
+                auto* variable = lookupVariable(identifier);
+                if (!variable)
                 {
-                    expression = std::make_unique<CastExpression>(result->second->type, std::move(expression));
+                    error("Could not assign to unknown variable ", identifier);
                 }
-                return {Statement::Assignment{result->second, std::move(expression)}};
+                writeVariable(variable);
+                convert(expression, variable->type);
+                return {Statement::Assignment{variable, std::move(expression)}};
             }
             [[fallthrough]];
         }
@@ -265,135 +577,285 @@ Statement Parser::parseStatement()
     }
 }
 
-std::unique_ptr<Expression> Parser::parseExpression()
+namespace
+{
+/// Binding power of every binary operator. Operators with a higher precedence bind tighter. Tokens that are not
+/// binary operators have a precedence of 0.
+int binaryPrecedence(Token::TokenType type)
 {
-    auto expression = parseOrExpression();
-    if (!maybeConsume(Token::AsKeyword))
+    switch (type)
     {
-        return expression;
+        case Token::OrKeyword: return 1;
+        case Token::AndKeyword: return 2;
+        case Token::Less:
+        case Token::Greater:
+        case Token::LessEqual:
+        case Token::GreaterEqual:
+        case Token::Equal:
+        case Token::NotEqual: return 3;
+        case Token::Plus:
+        case Token::Minus: return 4;
+        case Token::Times:
+        case Token::Divide: return 5;
+        default: return 0;
     }
-    auto type = parseType();
-    return std::make_unique<CastExpression>(type, std::move(expression));
 }
 
-namespace
+std::unique_ptr<Expression> makeBinary(std::unique_ptr<Expression>&& lhs, Token::TokenType op,
+                                       std::unique_ptr<Expression>&& rhs)
 {
-Type commonType(std::unique_ptr<Expression>& lhs, std::unique_ptr<Expression>& rhs)
-{
-    if (lhs->type == Type::Double && rhs->type != Type::Double)
+    Type type;
+    if (op == Token::AndKeyword || op == Token::OrKeyword)
     {
-        rhs = std::make_unique<CastExpression>(Type::Double, std::move(rhs));
-        return Type::Double;
+        type = Type::Bool;
+        convert(lhs, Type::Bool);
+        convert(rhs, Type::Bool);
     }
-    else if (rhs->type == Type::Double && lhs->type != Type::Double)
+    else if (binaryPrecedence(op) == binaryPrecedence(Token::Less))
     {
-        lhs = std::make_unique<CastExpression>(Type::Double, std::move(lhs));
-        return Type::Double;
+        Type operands = commonType(lhs, rhs);
+        type = isVector(operands) ? *vectorType(Type::Integer, laneCount(operands)) : Type::Bool;
     }
-    return Type::Integer;
-}
-
-} // namespace
-
-template <std::unique_ptr<Expression> (Parser::*parse)(), Token::TokenType... tokenTypes>
-std::unique_ptr<Expression> Parser::parseBinaryExpression()
-{
-    auto lhs = (this->*parse)();
-    while (m_curr != m_end && ((m_curr->tokenType == tokenTypes) || ...))
+    else
     {
-        auto op = m_curr->tokenType;
-        m_curr++;
-        auto rhs = (this->*parse)();
-        Type type;
-        if (op == Token::AndKeyword || op == Token::OrKeyword)
+        type = commonType(lhs, rhs);
+        // There is no arithmetic on 'bool', it is done in 'int' instead.
+        if (type == Type::Bool)
         {
             type = Type::Integer;
+            convert(lhs, type);
+            convert(rhs, type);
         }
-        else if (op == Token::Less || op == Token::Greater || op == Token::LessEqual || op == Token::GreaterEqual
-                 || op == Token::Equal || op == Token::NotEqual)
-        {
-            type = Type::Integer;
-            commonType(lhs, rhs);
-        }
-        else
-        {
-            type = commonType(lhs, rhs);
-        }
-        lhs = std::make_unique<BinaryExpression>(type, std::move(lhs), op, std::move(rhs));
     }
-    return lhs;
+    return std::make_unique<BinaryExpression>(type, std::move(lhs), op, std::move(rhs));
 }
 
-std::unique_ptr<Expression> Parser::parseOrExpression()
+std::optional<BuiltinExpression::Kind> builtinKind(std::string_view identifier)
 {
-    return parseBinaryExpression<&Parser::parseAndExpression, Token::AndKeyword>();
-}
-
-std::unique_ptr<Expression> Parser::parseAndExpression()
-{
-    return parseBinaryExpression<&Parser::parseCmpExpression, Token::OrKeyword>();
+    static const std::pair<std::string_view, BuiltinExpression::Kind> builtins[] = {
+        {"extract", BuiltinExpression::Extract}, {"insert", BuiltinExpression::Insert},
+        {"sum", BuiltinExpression::Sum},         {"product", BuiltinExpression::Product},
+        {"min", BuiltinExpression::Min},         {"max", BuiltinExpression::Max},
+    };
+    for (auto& [name, kind] : builtins)
+    {
+        if (name == identifier)
+        {
+            return kind;
+        }
+    }
+    return std::nullopt;
 }
 
-std::unique_ptr<Expression> Parser::parseCmpExpression()
+std::unique_ptr<Expression> makeBuiltin(BuiltinExpression::Kind kind, std::string_view identifier,
+                                        std::vector<std::unique_ptr<Expression>>&& arguments)
 {
-    return parseBinaryExpression<&Parser::parseAddExpression, Token::Less, Token::LessEqual, Token::Greater,
-                                 Token::GreaterEqual, Token::Equal, Token::NotEqual>();
+    std::size_t arity = kind == BuiltinExpression::Extract ? 2 : kind == BuiltinExpression::Insert ? 3 : 1;
+    if (arguments.size() != arity)
+    {
+        error("Wrong number of arguments given for call to ", identifier);
+    }
+    Type vector = arguments[0]->type;
+    if (!isVector(vector))
+    {
+        error("First argument of ", identifier, " must be a vector");
+    }
+    Type type = elementType(vector);
+    if (kind == BuiltinExpression::Extract || kind == BuiltinExpression::Insert)
+    {
+        convert(arguments[1], Type::Integer);
+    }
+    if (kind == BuiltinExpression::Insert)
+    {
+        convert(arguments[2], elementType(vector));
+        type = vector;
+    }
+    return std::make_unique<BuiltinExpression>(type, kind, std::move(arguments));
 }
 
-std::unique_ptr<Expression> Parser::parseAddExpression()
+/// Entry of the operator stack used by 'Parser::parseExpression'. 'Paren' and 'Call' open a new frame that is closed
+/// by the matching ')'.
+struct Operator
 {
-    return parseBinaryExpression<&Parser::parseMulExpression, Token::Plus, Token::Minus>();
-}
+    enum Kind
+    {
+        Binary,
+        Negate,
+        Paren,
+        Call,
+    } kind;
+    Token::TokenType binary{};
+    /// Callee of a 'Call', or null if it calls the builtin 'builtin' named 'identifier'.
+    Function* function{};
+    /// Index of the first argument on the operand stack. Only used by 'Call'.
+    std::size_t operandBase{};
+    BuiltinExpression::Kind builtin{};
+    std::string_view identifier{};
+};
 
-std::unique_ptr<Expression> Parser::parseMulExpression()
-{
-    return parseBinaryExpression<&Parser::parseUnaryExpression, Token::Times, Token::Divide>();
-}
+} // namespace
 
-std::unique_ptr<Expression> Parser::parseUnaryExpression()
+Function* Parser::lookupFunction(const std::string& identifier)
 {
-    if (maybeConsume(Token::Minus))
+    auto result = m_functions.find(identifier);
+    if (result == m_functions.end())
     {
-        auto expression = parsePostfixExpression();
-        return std::make_unique<NegateExpression>(expression->type, std::move(expression));
+        if (builtinKind(identifier))
+        {
+            return nullptr;
+        }
+        error("Cannot call unknown function ", identifier);
     }
-    return parsePostfixExpression();
+    return result->second;
 }
 
-std::unique_ptr<Expression> Parser::parsePostfixExpression()
+std::unique_ptr<Expression> Parser::parseExpression()
 {
-    if (m_curr != m_end && m_curr->tokenType == Token::Identifier && std::next(m_curr) != m_end
-        && std::next(m_curr)->tokenType == Token::OpenParen)
+    std::vector<std::unique_ptr<Expression>> operands;
+    std::vector<Operator> operators;
+
+    auto popOperand = [&]
+    {
+        auto operand = std::move(operands.back());
+        operands.pop_back();
+        return operand;
+    };
+
+    // Applies the topmost unary or binary operator to the operand stack.
+    auto reduce = [&]
     {
-        auto functionName = expectIdentifier();
-        expect(Token::OpenParen);
-        std::vector<std::unique_ptr<Expression>> arguments;
-        arguments.push_back(parseExpression());
-        while (maybeConsume(Token::Colon))
+        Operator op = operators.back();
+        operators.pop_back();
+        auto operand = popOperand();
+        if (op.kind == Operator::Negate)
         {
-            arguments.push_back(parseExpression());
+            if (operand->type == Type::Bool)
+            {
+                convert(operand, Type::Integer);
+            }
+            Type type = operand->type;
+            operands.push_back(std::make_unique<NegateExpression>(type, std::move(operand)));
+            return;
         }
-        expect(Token::CloseParen);
-        auto result = m_functions.find(functionName);
-        if (result == m_functions.end())
+        auto lhs = popOperand();
+        operands.push_back(makeBinary(std::move(lhs), op.binary, std::move(operand)));
+    };
+
+    // Applies all operators of the innermost parenthesis, call or the whole expression.
+    auto reduceFrame = [&]
+    {
+        while (!operators.empty()
+               && (operators.back().kind == Operator::Binary || operators.back().kind == Operator::Negate))
         {
-            error("Cannot call unknown function ") << functionName;
+            reduce();
+        }
+    };
+
+    auto finishCall = [&]
+    {
+        Operator call = operators.back();
+        Function* function = call.function;
+        std::vector<std::unique_ptr<Expression>> arguments(
+            std::make_move_iterator(operands.begin() + call.operandBase), std::make_move_iterator(operands.end()));
+        operands.resize(call.operandBase);
+        operators.pop_back();
+        if (!function)
+        {
+            operands.push_back(makeBuiltin(call.builtin, call.identifier, std::move(arguments)));
+            return;
         }
-        auto* function = result->second;
         if (function->parameters.size() != arguments.size())
         {
-            error("Too many arguments given for call to ") << functionName;
+            error("Wrong number of arguments given for call to ", function->identifier);
         }
         for (std::size_t i = 0; i < arguments.size(); i++)
         {
-            if (arguments[i]->type != function->parameters[i]->type)
+            convert(arguments[i], function->parameters[i]->type);
+        }
+        operands.push_back(std::make_unique<CallExpression>(function->returnType, function, std::move(arguments)));
+    };
+
+    while (true)
+    {
+        // Prefix position: Any amount of '-', '(' and calls, followed by an atom or the ')' of an argumentless call.
+        while (true)
+        {
+            if (maybeConsume(Token::Minus))
+            {
+                operators.push_back({Operator::Negate});
+                continue;
+            }
+            if (maybeConsume(Token::OpenParen))
             {
-                arguments[i] = std::make_unique<CastExpression>(function->parameters[i]->type, std::move(arguments[i]));
+                operators.push_back({Operator::Paren});
+                continue;
+            }
+            if (m_curr != m_end && m_curr->tokenType == Token::Identifier && std::next(m_curr) != m_end
+                && std::next(m_curr)->tokenType == Token::OpenParen)
+            {
+                std::string_view identifier = std::get<std::string>(m_curr->variant);
+                auto* function = lookupFunction(expectIdentifier());
+                m_curr++;
+                operators.push_back({Operator::Call, {}, function, operands.size(),
+                                     function ? BuiltinExpression::Kind{} : *builtinKind(identifier), identifier});
+                if (!maybeConsume(Token::CloseParen))
+                {
+                    continue;
+                }
+                finishCall();
+                break;
             }
+            operands.push_back(parseAtom());
+            break;
+        }
+
+        // Infix position: Binary operators continue the current frame. Anything else ends it, optionally after a cast.
+        bool operandFollows = false;
+        while (!operandFollows)
+        {
+            if (m_curr != m_end)
+            {
+                if (int precedence = binaryPrecedence(m_curr->tokenType))
+                {
+                    while (!operators.empty()
+                           && (operators.back().kind == Operator::Negate
+                               || (operators.back().kind == Operator::Binary
+                                   && binaryPrecedence(operators.back().binary) >= precedence)))
+                    {
+                        reduce();
+                    }
+                    operators.push_back({Operator::Binary, m_curr->tokenType});
+                    m_curr++;
+                    operandFollows = true;
+                    continue;
+                }
+            }
+            reduceFrame();
+            if (maybeConsume(Token::AsKeyword))
+            {
+                auto type = parseType();
+                auto operand = popOperand();
+                convert(operand, type);
+                operands.push_back(std::move(operand));
+            }
+            if (operators.empty())
+            {
+                return popOperand();
+            }
+            if (operators.back().kind == Operator::Call && maybeConsume(Token::Comma))
+            {
+                operandFollows = true;
+                continue;
+            }
+            expect(Token::CloseParen);
+            if (operators.back().kind == Operator::Paren)
+            {
+                operators.pop_back();
+                continue;
+            }
+            finishCall();
         }
-        return std::make_unique<CallExpression>(function->returnType, function, std::move(arguments));
     }
-    return parseAtom();
 }
 
 std::unique_ptr<Expression> Parser::parseAtom()
@@ -406,10 +868,21 @@ std::unique_ptr<Expression> Parser::parseAtom()
     {
         case Token::Number:
         {
-            auto number = std::make_unique<Atom>(Type::Integer, std::get<int>(m_curr->variant));
+            // Literals are 'int' unless they do not fit.
+            auto value = std::get<std::int64_t>(m_curr->variant);
+            bool fitsInt = value >= std::numeric_limits<std::int32_t>::min()
+                           && value <= std::numeric_limits<std::int32_t>::max();
+            auto number = std::make_unique<Atom>(fitsInt ? Type::Integer : Type::Int64, value);
             m_curr++;
             return number;
         }
+        case Token::TrueKeyword:
+        case Token::FalseKeyword:
+        {
+            auto boolean = std::make_unique<Atom>(Type::Bool, m_curr->tokenType == Token::TrueKeyword);
+            m_curr++;
+            return boolean;
+        }
         case Token::Decimal:
         {
             auto number = std::make_unique<Atom>(Type::Double, std::get<double>(m_curr->variant));
@@ -419,13 +892,14 @@ std::unique_ptr<Expression> Parser::parseAtom()
         case Token::Identifier:
         {
             auto identifier = expectIdentifier();
-            auto result = m_variables.find(identifier);
-            if (result == m_variables.end())
+            auto* variable = lookupVariable(identifier);
+            if (!variable)
             {
-                error("Could not read from unknown variable ") << identifier;
+                error("Could not read from unknown variable ", identifier);
             }
-            return std::make_unique<Atom>(result->second->type, result->second);
+            readVariable(variable);
+            return std::make_unique<Atom>(variable->type, variable);
         }
-        default: error("Expected number, decimal or '(' instead of ") << m_curr->tokenType;
+        default: error("Expected number, decimal or '(' instead of ", m_curr->tokenType);
     }
 }
@@ -12,8 +12,20 @@ class Parser
     Iterator m_curr;
     Iterator m_end;
     Function* m_currentFunc;
+    std::size_t m_functionCount = 0;
     std::unordered_map<std::string_view, Function*> m_functions;
-    std::unordered_map<std::string_view, VarDecl*> m_variables;
+    /// Variables visible at the current point of the function in declaration order. Lookup searches from the back, so
+    /// that inner declarations shadow outer ones, and leaving a block truncates the vector to its size at block entry.
+    std::vector<VarDecl*> m_variables;
+
+    struct ParallelRegion
+    {
+        Statement::ParallelFor* loop;
+        /// Variables with a slot below this one are declared outside of the loop.
+        std::size_t firstSlot;
+    };
+    /// 'parallel for' loops enclosing the current point, innermost last.
+    std::vector<ParallelRegion> m_parallelRegions;
 
     void expect(Token::TokenType type);
 
@@ -29,35 +41,71 @@ class Parser
 
     std::string expectIdentifier();
 
-    template <std::unique_ptr<Expression> (Parser::*parse)(), Token::TokenType... tokenTypes>
-    std::unique_ptr<Expression> parseBinaryExpression();
+    /// Assigns the next free slot of the current function to 'variable' and makes it visible in the current scope.
+    void declareVariable(VarDecl* variable);
 
-public:
-    Parser(Iterator begin, Iterator end) : m_curr(begin), m_end(end) {}
+    [[nodiscard]] VarDecl* lookupVariable(std::string_view identifier) const;
 
-    File parseFile();
+    /// Records a read of 'variable' at the current point, capturing it into every enclosing 'parallel for' it is
+    /// declared outside of.
+    void readVariable(VarDecl* variable);
 
-    Type parseType();
+    /// Throws unless 'variable' may be written at the current point. Within a 'parallel for' that is only the case for
+    /// variables declared inside the loop and for reduction variables of the loop.
+    void writeVariable(VarDecl* variable);
 
-    std::unique_ptr<Function> parseFunction();
+    Statement::ParallelFor parseParallelFor();
 
-    Statement parseStatement();
+    Likelihood parseLikelihood();
 
-    std::unique_ptr<Expression> parseExpression();
+    LoopHints parseLoopHints();
+
+    /// Parses the positive integer literal given as count to a loop hint.
+    unsigned parseHintCount();
+
+    std::vector<Statement> parseBlock();
+
+    /// Returns null if 'identifier' names no function but a 'BuiltinExpression'.
+    Function* lookupFunction(const std::string& identifier);
+
+    std::unique_ptr<Expression> parseAtom();
+
+public:
+    Parser(Iterator begin, Iterator end) : m_curr(begin), m_end(end) {}
 
-    std::unique_ptr<Expression> parseOrExpression();
+    /// Continues with the tokens in ['begin', 'end'), while functions parsed before stay visible. Allows parsing a file
+    /// one piece at a time. Functions must outlive the parser, as later functions refer to them.
+    void setTokens(Iterator begin, Iterator end)
+    {
+        m_curr = begin;
+        m_end = end;
+    }
 
-    std::unique_ptr<Expression> parseAndExpression();
+    File parseFile();
 
-    std::unique_ptr<Expression> parseCmpExpression();
+    /// The functions calls may refer to by name. Allows undoing the definitions of a failed 'parseFunction', which
+    /// makes a function visible before parsing its body so that it can call itself.
+    [[nodiscard]] const std::unordered_map<std::string_view, Function*>& getFunctions() const
+    {
+        return m_functions;
+    }
 
-    std::unique_ptr<Expression> parseAddExpression();
+    void setFunctions(std::unordered_map<std::string_view, Function*> functions)
+    {
+        m_functions = std::move(functions);
+    }
 
-    std::unique_ptr<Expression> parseMulExpression();
+    /// Parses the remaining tokens as a single expression, optionally followed by a semicolon, and returns a function
+    /// called 'identifier' without parameters returning its value. The function is not visible to code parsed later.
+    std::unique_ptr<Function> parseExpressionFunction(std::string identifier);
 
-    std::unique_ptr<Expression> parseUnaryExpression();
+    Type parseType();
 
-    std::unique_ptr<Expression> parsePostfixExpression();
+    std::unique_ptr<Function> parseFunction();
 
-    std::unique_ptr<Expression> parseAtom();
+    Statement parseStatement();
+
+    /// Parses an expression using operator precedence parsing with explicit operand and operator stacks instead of
+    /// recursive descent. Memory usage grows with the nesting depth of the expression, stack usage does not.
+    std::unique_ptr<Expression> parseExpression();
 };
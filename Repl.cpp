@@ -0,0 +1,307 @@
+#include "Repl.hpp"
+
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <charconv>
+#include <cstdint>
+#include <iterator>
+
+#include "Driver.hpp"
+#include "Error.hpp"
+
+namespace
+{
+llvm::Error makeError(const llvm::Twine& message)
+{
+    return llvm::make_error<llvm::StringError>(message, llvm::inconvertibleErrorCode());
+}
+
+bool sameSignature(const Function& lhs, const Function& rhs)
+{
+    if (lhs.external != rhs.external || lhs.returnType != rhs.returnType
+        || lhs.parameters.size() != rhs.parameters.size())
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < lhs.parameters.size(); i++)
+    {
+        if (lhs.parameters[i]->type != rhs.parameters[i]->type)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T>
+T call(llvm::JITTargetAddress address)
+{
+    return reinterpret_cast<T (*)()>(static_cast<std::uintptr_t>(address))();
+}
+
+std::string toString(double value)
+{
+    char buffer[32];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), value);
+    return std::string(buffer, result.ptr);
+}
+
+} // namespace
+
+llvm::Expected<std::unique_ptr<Repl>> Repl::create(unsigned optLevel, CodegenOptions codegen)
+{
+    // Nothing within the session could call them, and they would keep the name of the function across redefinitions.
+    if (codegen.batchEntryPoints)
+    {
+        return makeError("batch entry points are not supported in the REPL");
+    }
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!builder)
+    {
+        return builder.takeError();
+    }
+    auto targetMachine = builder->createTargetMachine();
+    if (!targetMachine)
+    {
+        return targetMachine.takeError();
+    }
+    auto stubsManagerBuilder = llvm::orc::createLocalIndirectStubsManagerBuilder(builder->getTargetTriple());
+    if (!stubsManagerBuilder)
+    {
+        return makeError("indirection stubs are not supported on " + builder->getTargetTriple().str());
+    }
+    llvm::orc::LLJITBuilder jitBuilder;
+    jitBuilder.setJITTargetMachineBuilder(std::move(*builder));
+    auto jit = jitBuilder.create();
+    if (!jit)
+    {
+        return jit.takeError();
+    }
+    if (auto error = addHostSymbols(**jit))
+    {
+        return error;
+    }
+
+    std::unique_ptr<Repl> repl(new Repl);
+    repl->m_jit = std::move(*jit);
+    repl->m_targetMachine = std::move(*targetMachine);
+    repl->m_stubs = stubsManagerBuilder();
+    repl->m_optLevel = optLevel;
+    repl->m_codegenOptions = std::move(codegen);
+    return repl;
+}
+
+llvm::Expected<llvm::JITTargetAddress> Repl::compile(const Function& function, const std::string& name,
+                                                     const llvm::orc::ResourceTrackerSP& tracker)
+{
+    auto context = std::make_unique<llvm::LLVMContext>();
+    Codegen codegen(*context, m_targetMachine.get(), m_codegenOptions, &m_analysis);
+    codegen.visit(function);
+    auto module = codegen.takeModule();
+    module->getFunction(function.identifier)->setName(name);
+    // The JIT names the function running the module's constructors after the module.
+    module->setModuleIdentifier(name);
+    for (auto& iter : *module)
+    {
+        if (!iter.isDeclaration() || iter.isIntrinsic())
+        {
+            continue;
+        }
+        // Callees are reached through stubs, which may be anywhere in the address space.
+        iter.setVisibility(llvm::GlobalValue::DefaultVisibility);
+        // Attributes of the callees as they are defined now, which a redefinition may invalidate.
+        for (auto kind : {llvm::Attribute::ReadNone, llvm::Attribute::NoFree, llvm::Attribute::NoSync,
+                          llvm::Attribute::NoRecurse, llvm::Attribute::WillReturn})
+        {
+            iter.removeFnAttr(kind);
+        }
+    }
+    optimize(*module, m_optLevel, m_targetMachine.get());
+
+    if (auto error = m_jit->addIRModule(tracker, llvm::orc::ThreadSafeModule(std::move(module), std::move(context))))
+    {
+        return error;
+    }
+    // Runs the module's constructors, e.g. the one selecting the versions of multiversioned functions.
+    if (auto error = m_jit->initialize(tracker->getJITDylib()))
+    {
+        return error;
+    }
+    auto symbol = m_jit->lookup(tracker->getJITDylib(), name);
+    if (!symbol)
+    {
+        return symbol.takeError();
+    }
+    return symbol->getAddress();
+}
+
+llvm::Error Repl::define(Function& function)
+{
+    if (function.external)
+    {
+        m_analysis.analyze(function);
+        m_definitions.insert_or_assign(function.identifier, Definition{&function, nullptr});
+        return llvm::Error::success();
+    }
+
+    auto& dylib = m_jit->getMainJITDylib();
+    auto tracker = dylib.createResourceTracker();
+    auto address = compile(function, function.identifier + "." + std::to_string(m_generation++), tracker);
+    if (!address)
+    {
+        return llvm::joinErrors(address.takeError(), tracker->remove());
+    }
+    auto previous = m_definitions.find(function.identifier);
+    if (previous == m_definitions.end())
+    {
+        if (auto error = m_stubs->createStub(function.identifier, *address,
+                                             llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable))
+        {
+            return error;
+        }
+        auto stub = m_stubs->findStub(function.identifier, false);
+        if (auto error =
+                dylib.define(llvm::orc::absoluteSymbols({{m_jit->mangleAndIntern(function.identifier), stub}})))
+        {
+            return error;
+        }
+        m_definitions.emplace(function.identifier, Definition{&function, std::move(tracker)});
+        return llvm::Error::success();
+    }
+
+    if (auto error = m_stubs->updatePointer(function.identifier, *address))
+    {
+        return error;
+    }
+    // Only the stub referred to the previous code, apart from the code itself.
+    auto previousTracker = std::move(previous->second.tracker);
+    previous->second = {&function, std::move(tracker)};
+    return previousTracker->remove();
+}
+
+llvm::Expected<std::string> Repl::evaluate(const Function& function)
+{
+    if (isVector(function.returnType))
+    {
+        return makeError("vectors cannot be printed");
+    }
+    auto tracker = m_jit->getMainJITDylib().createResourceTracker();
+    auto address = compile(function, function.identifier, tracker);
+    if (!address)
+    {
+        return llvm::joinErrors(address.takeError(), tracker->remove());
+    }
+    std::string result;
+    switch (function.returnType)
+    {
+        case Type::Bool: result = call<bool>(*address) ? "true" : "false"; break;
+        case Type::Int8: result = std::to_string(call<std::int8_t>(*address)); break;
+        case Type::Int16: result = std::to_string(call<std::int16_t>(*address)); break;
+        case Type::Integer: result = std::to_string(call<std::int32_t>(*address)); break;
+        case Type::Int64: result = std::to_string(call<std::int64_t>(*address)); break;
+        case Type::Float: result = toString(call<float>(*address)); break;
+        default: result = toString(call<double>(*address)); break;
+    }
+    if (auto error = tracker->remove())
+    {
+        return error;
+    }
+    return result;
+}
+
+void Repl::run(llvm::raw_ostream& out)
+{
+    std::string input = std::move(m_input);
+    m_input.clear();
+    auto previousFunctions = m_parser.getFunctions();
+    std::vector<std::unique_ptr<Function>> functions;
+    try
+    {
+        auto tokens = tokenize(input);
+        if (tokens.empty())
+        {
+            return;
+        }
+        m_parser.setTokens(tokens.begin(), tokens.end());
+        auto first = tokens.front().tokenType;
+        if (first != Token::FunKeyword && first != Token::ExportKeyword && first != Token::ExternKeyword)
+        {
+            auto function = m_parser.parseExpressionFunction("expr." + std::to_string(m_generation++));
+            auto result = evaluate(*function);
+            if (!result)
+            {
+                out << "error: " << llvm::toString(result.takeError()) << '\n';
+                return;
+            }
+            out << *result << '\n';
+            return;
+        }
+        functions = m_parser.parseFile().functions;
+    }
+    catch (const CompileError& e)
+    {
+        m_parser.setFunctions(std::move(previousFunctions));
+        out << e.what() << '\n';
+        return;
+    }
+
+    for (auto& iter : functions)
+    {
+        auto previous = m_definitions.find(iter->identifier);
+        if (previous != m_definitions.end() && !sameSignature(*previous->second.function, *iter))
+        {
+            m_parser.setFunctions(std::move(previousFunctions));
+            out << "error: " << iter->identifier << " cannot be redefined with a different signature\n";
+            return;
+        }
+    }
+    for (std::size_t i = 0; i < functions.size(); i++)
+    {
+        if (auto error = define(*functions[i]))
+        {
+            // Keep the definitions that did compile.
+            auto visible = m_parser.getFunctions();
+            for (std::size_t j = i; j < functions.size(); j++)
+            {
+                visible.erase(functions[j]->identifier);
+                if (auto previous = m_definitions.find(functions[j]->identifier); previous != m_definitions.end())
+                {
+                    visible.emplace(previous->second.function->identifier, previous->second.function);
+                }
+            }
+            m_parser.setFunctions(std::move(visible));
+            out << "error: " << llvm::toString(std::move(error)) << '\n';
+            functions.resize(i);
+            break;
+        }
+    }
+    std::move(functions.begin(), functions.end(), std::back_inserter(m_functions));
+}
+
+bool Repl::addLine(std::string_view line, llvm::raw_ostream& out)
+{
+    m_input.append(line);
+    m_input.push_back('\n');
+    std::ptrdiff_t depth = 0;
+    try
+    {
+        for (auto& iter : tokenize(m_input))
+        {
+            depth += iter.tokenType == Token::OpenBrace ? 1 : iter.tokenType == Token::CloseBrace ? -1 : 0;
+        }
+    }
+    catch (const CompileError&)
+    {
+        // Reported by 'run'.
+    }
+    if (depth > 0)
+    {
+        return false;
+    }
+    run(out);
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Analysis.hpp"
+#include "Codegen.hpp"
+#include "Parser.hpp"
+
+/// Interactive session compiling SimpleC one input at a time. An input either defines functions, which are compiled
+/// into a module of their own, or is an expression, which is compiled and evaluated on the spot:
+///
+///     > fun square(x: int): int { return x * x; }
+///     > square(7)
+///     49
+///
+/// Functions may be redefined, keeping their signature. Calls from other functions go through an indirection stub per
+/// function, which a redefinition points at the new code, so that callers compiled before call the new definition
+/// without being recompiled, and the code of the previous definition is freed. Each input therefore costs time
+/// depending on its own size only, regardless of how many functions are defined. As callees may change, functions are
+/// analyzed and lowered knowing nothing about their callees beyond their signature.
+class Repl
+{
+    struct Definition
+    {
+        Function* function;
+        /// Owns the code of the definition. Null for 'extern' functions.
+        llvm::orc::ResourceTrackerSP tracker;
+    };
+
+    std::unique_ptr<llvm::orc::LLJIT> m_jit;
+    std::unique_ptr<llvm::TargetMachine> m_targetMachine;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> m_stubs;
+    unsigned m_optLevel = 0;
+    CodegenOptions m_codegenOptions;
+
+    Parser m_parser{{}, {}};
+    /// Treats other functions than 'extern' ones as unknown, see 'FunctionAnalysis'.
+    FunctionAnalysis m_analysis{true};
+    /// Every function parsed, including previous definitions, which the syntax trees of later ones may refer to.
+    std::vector<std::unique_ptr<Function>> m_functions;
+    std::unordered_map<std::string, Definition> m_definitions;
+    /// Lines of the input entered so far.
+    std::string m_input;
+    /// Distinguishes the symbols of the code of different definitions of a function and of different expressions.
+    std::size_t m_generation = 0;
+
+    Repl() = default;
+
+    /// Lowers, optimizes and adds 'function' to the JIT under 'tracker', naming its code 'name'. Returns the address
+    /// of the code.
+    llvm::Expected<llvm::JITTargetAddress> compile(const Function& function, const std::string& name,
+                                                   const llvm::orc::ResourceTrackerSP& tracker);
+
+    /// Compiles 'function' and points its stub at the code, creating the stub on the first definition.
+    llvm::Error define(Function& function);
+
+    /// Compiles 'function', as returned by 'Parser::parseExpressionFunction', calls it and returns its result as text.
+    llvm::Expected<std::string> evaluate(const Function& function);
+
+    /// Compiles the complete input in 'm_input', writing the result or errors to 'out'.
+    void run(llvm::raw_ostream& out);
+
+public:
+    /// Creates a session compiling for the host at the optimization level 'optLevel' (0 to 3). Fails if 'codegen'
+    /// requests batch entry points.
+    static llvm::Expected<std::unique_ptr<Repl>> create(unsigned optLevel = 2, CodegenOptions codegen = {});
+
+    /// Adds 'line' to the current input. Once every brace opened in the input has been closed, the input is run, with
+    /// the value of an expression or any errors written to 'out', and true is returned. Returns false if the input
+    /// continues on the next line.
+    bool addLine(std::string_view line, llvm::raw_ostream& out);
+};
@@ -0,0 +1,467 @@
+#include "Runtime.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+namespace
+{
+using Body = void (*)(std::int64_t, std::int64_t, void*);
+
+/// Set on threads currently running a loop body, where nested loops run serially.
+thread_local bool insideParallelLoop = false;
+
+/// Runs one 'parallel for' at a time. Every participant, the calling thread being participant 0, owns a deque of
+/// ranges. Participants take ranges from the back of their own deque and, when that is empty, steal from the front of
+/// a random other one. Ranges larger than the grain size are split in half before running, with the upper half pushed
+/// onto the owner's deque. The front of a deque therefore always holds its largest ranges, which keeps steals rare
+/// while idle participants still find work as long as there is any.
+class ThreadPool
+{
+    struct Range
+    {
+        std::int64_t begin;
+        std::int64_t end;
+
+        /// Number of iterations, which may exceed the range of 'std::int64_t' when the bounds are far apart.
+        [[nodiscard]] std::uint64_t size() const
+        {
+            return static_cast<std::uint64_t>(end) - static_cast<std::uint64_t>(begin);
+        }
+    };
+
+    /// The iteration 'offset' iterations after 'begin', computed without signed overflow.
+    static std::int64_t advance(std::int64_t begin, std::uint64_t offset)
+    {
+        return static_cast<std::int64_t>(static_cast<std::uint64_t>(begin) + offset);
+    }
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    /// Serializes loops started by different threads.
+    std::mutex m_loopMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::uint64_t m_generation = 0;
+    std::size_t m_busyThreads = 0;
+    bool m_shutdown = false;
+
+    Body m_body{};
+    void* m_context{};
+    std::uint64_t m_grainSize = 1;
+    /// Iterations of the current loop not run yet.
+    std::atomic<std::uint64_t> m_remaining{0};
+
+    static std::size_t threadCount()
+    {
+        if (const char* value = std::getenv("SIMPLEC_NUM_THREADS"))
+        {
+            return std::max(1L, std::strtol(value, nullptr, 10));
+        }
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    void push(std::size_t participant, Range range)
+    {
+        auto& queue = *m_queues[participant];
+        std::lock_guard lock(queue.mutex);
+        queue.ranges.push_back(range);
+    }
+
+    std::optional<Range> pop(std::size_t participant)
+    {
+        auto& queue = *m_queues[participant];
+        std::lock_guard lock(queue.mutex);
+        if (queue.ranges.empty())
+        {
+            return std::nullopt;
+        }
+        Range range = queue.ranges.back();
+        queue.ranges.pop_back();
+        return range;
+    }
+
+    std::optional<Range> steal(std::size_t participant, std::minstd_rand& random)
+    {
+        std::size_t start = random() % m_queues.size();
+        for (std::size_t i = 0; i < m_queues.size(); i++)
+        {
+            std::size_t victim = (start + i) % m_queues.size();
+            if (victim == participant)
+            {
+                continue;
+            }
+            auto& queue = *m_queues[victim];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.ranges.empty())
+            {
+                Range range = queue.ranges.front();
+                queue.ranges.pop_front();
+                return range;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void run(std::size_t participant, Range range)
+    {
+        while (range.size() > m_grainSize)
+        {
+            std::int64_t middle = advance(range.begin, range.size() / 2);
+            push(participant, {middle, range.end});
+            range.end = middle;
+        }
+        m_body(range.begin, range.end, m_context);
+        m_remaining.fetch_sub(range.size(), std::memory_order_release);
+    }
+
+    void participate(std::size_t participant)
+    {
+        std::minstd_rand random(participant + 1);
+        while (m_remaining.load(std::memory_order_acquire) != 0)
+        {
+            auto range = pop(participant);
+            if (!range)
+            {
+                range = steal(participant, random);
+            }
+            if (!range)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            run(participant, *range);
+        }
+    }
+
+    void workerMain(std::size_t participant)
+    {
+        insideParallelLoop = true;
+        std::uint64_t generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_shutdown || m_generation != generation; });
+                if (m_shutdown)
+                {
+                    return;
+                }
+                generation = m_generation;
+            }
+            participate(participant);
+            std::lock_guard lock(m_mutex);
+            if (--m_busyThreads == 0)
+            {
+                m_done.notify_one();
+            }
+        }
+    }
+
+public:
+    ThreadPool()
+    {
+        std::size_t count = threadCount();
+        for (std::size_t i = 0; i < count; i++)
+        {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (std::size_t i = 1; i < count; i++)
+        {
+            m_threads.emplace_back([this, i] { workerMain(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_wake.notify_all();
+        for (auto& iter : m_threads)
+        {
+            iter.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void parallelFor(std::int64_t begin, std::int64_t end, Body body, void* context)
+    {
+        std::uint64_t count = Range{begin, end}.size();
+        if (m_threads.empty())
+        {
+            insideParallelLoop = true;
+            body(begin, end, context);
+            insideParallelLoop = false;
+            return;
+        }
+
+        std::lock_guard loopLock(m_loopMutex);
+        m_body = body;
+        m_context = context;
+        // Around eight chunks per participant balance uneven iterations without paying for the splits too often.
+        std::uint64_t participants = m_queues.size();
+        m_grainSize = std::max<std::uint64_t>(1, count / (participants * 8));
+        m_remaining.store(count, std::memory_order_relaxed);
+        // Start every participant out on its own contiguous share, so that steals are only needed for balancing. Share
+        // 'i' begins 'count * i / participants' iterations in, computed as 'quotient * i + remainder * i / participants'
+        // so that the product cannot overflow.
+        std::uint64_t quotient = count / participants;
+        std::uint64_t remainder = count % participants;
+        auto shareOffset = [&](std::uint64_t i) { return quotient * i + remainder * i / participants; };
+        for (std::uint64_t i = 0; i < participants; i++)
+        {
+            std::int64_t shareBegin = advance(begin, shareOffset(i));
+            std::int64_t shareEnd = advance(begin, shareOffset(i + 1));
+            if (shareBegin != shareEnd)
+            {
+                push(i, {shareBegin, shareEnd});
+            }
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_generation++;
+            m_busyThreads = m_threads.size();
+        }
+        m_wake.notify_all();
+
+        insideParallelLoop = true;
+        participate(0);
+        insideParallelLoop = false;
+
+        // Workers may still be looking at the loop's state, wait until all of them are done with it.
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [&] { return m_busyThreads == 0; });
+    }
+};
+
+/// Process wide state behind 'simplec_profile_enter'. Every instrumented function is assigned an index the first time
+/// it is entered, which selects its counters within the table of every thread. Tables consist of fixed size chunks so
+/// that growing them never moves counters a caller further up the stack still holds a pointer to.
+class Profile
+{
+public:
+    static constexpr std::size_t COUNTERS = 3;
+    static constexpr std::size_t CHUNK_FUNCTIONS = 256;
+
+    using Chunk = std::array<std::uint64_t, COUNTERS * CHUNK_FUNCTIONS>;
+    using Table = std::vector<std::unique_ptr<Chunk>>;
+
+private:
+    /// Guards everything below. Only taken the first time a thread enters a function.
+    std::mutex m_mutex;
+    std::vector<std::string> m_names;
+    /// Owned here rather than by the threads, so that the counters of threads that exited are still reported.
+    std::vector<std::unique_ptr<Table>> m_tables;
+
+    void report()
+    {
+        std::lock_guard lock(m_mutex);
+        struct Entry
+        {
+            const std::string* name;
+            std::array<std::uint64_t, COUNTERS> counters;
+        };
+        std::vector<Entry> entries;
+        for (std::size_t i = 0; i < m_names.size(); i++)
+        {
+            Entry entry{&m_names[i], {}};
+            for (auto& table : m_tables)
+            {
+                if (i / CHUNK_FUNCTIONS < table->size())
+                {
+                    const auto* counters = (*table)[i / CHUNK_FUNCTIONS]->data() + i % CHUNK_FUNCTIONS * COUNTERS;
+                    for (std::size_t j = 0; j < COUNTERS; j++)
+                    {
+                        entry.counters[j] += counters[j];
+                    }
+                }
+            }
+            entries.push_back(entry);
+        }
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const Entry& lhs, const Entry& rhs)
+                         {
+                             return std::make_pair(lhs.counters[2], lhs.counters[0])
+                                    > std::make_pair(rhs.counters[2], rhs.counters[0]);
+                         });
+        std::uint64_t totalCycles = 0;
+        for (auto& iter : entries)
+        {
+            totalCycles += iter.counters[2];
+        }
+
+        std::FILE* output = stderr;
+        if (const char* path = std::getenv("SIMPLEC_PROFILE"))
+        {
+            output = std::fopen(path, "w");
+            if (!output)
+            {
+                std::perror(path);
+                return;
+            }
+        }
+        std::fprintf(output, "SimpleC flat profile of %zu thread(s). Cycles include callees.\n", m_tables.size());
+        std::fprintf(output, "%8s %16s %12s %16s  %s\n", "cycles%", "cycles", "calls", "loop iterations", "function");
+        for (auto& iter : entries)
+        {
+            double percentage = totalCycles == 0 ? 0 : 100.0 * static_cast<double>(iter.counters[2]) / totalCycles;
+            std::fprintf(output, "%8.2f %16" PRIu64 " %12" PRIu64 " %16" PRIu64 "  %s\n", percentage, iter.counters[2],
+                         iter.counters[0], iter.counters[1], iter.name->c_str());
+        }
+        if (output != stderr)
+        {
+            std::fclose(output);
+        }
+    }
+
+    Profile()
+    {
+        std::atexit([] { instance().report(); });
+    }
+
+public:
+    /// Never destroyed, as threads may still be running instrumented code while the program exits.
+    static Profile& instance()
+    {
+        static auto* profile = new Profile;
+        return *profile;
+    }
+
+    /// Returns the counters of the function identified by 'id' and 'name' within 'table', assigning the function an
+    /// index and creating or growing the table as needed. 'table' is set to a new table if it is null.
+    std::uint64_t* enter(Table*& table, std::int64_t* id, const char* name)
+    {
+        std::lock_guard lock(m_mutex);
+        std::int64_t index = __atomic_load_n(id, __ATOMIC_RELAXED);
+        if (index < 0)
+        {
+            index = static_cast<std::int64_t>(m_names.size());
+            m_names.emplace_back(name);
+            __atomic_store_n(id, index, __ATOMIC_RELEASE);
+        }
+        if (!table)
+        {
+            table = m_tables.emplace_back(std::make_unique<Table>()).get();
+        }
+        auto chunk = static_cast<std::size_t>(index) / CHUNK_FUNCTIONS;
+        while (table->size() <= chunk)
+        {
+            table->push_back(std::make_unique<Chunk>());
+        }
+        return (*table)[chunk]->data() + index % CHUNK_FUNCTIONS * COUNTERS;
+    }
+};
+
+thread_local Profile::Table* profileTable = nullptr;
+
+} // namespace
+
+void simplec_parallel_for(std::int64_t begin, std::int64_t end, Body body, void* context)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+    if (insideParallelLoop)
+    {
+        body(begin, end, context);
+        return;
+    }
+    static ThreadPool pool;
+    pool.parallelFor(begin, end, body, context);
+}
+
+std::uint64_t* simplec_profile_enter(std::int64_t* id, const char* name)
+{
+    std::int64_t index = __atomic_load_n(id, __ATOMIC_ACQUIRE);
+    if (index >= 0 && profileTable && static_cast<std::size_t>(index) / Profile::CHUNK_FUNCTIONS < profileTable->size())
+    {
+        return (*profileTable)[index / Profile::CHUNK_FUNCTIONS]->data()
+               + index % Profile::CHUNK_FUNCTIONS * Profile::COUNTERS;
+    }
+    return Profile::instance().enter(profileTable, id, name);
+}
+
+std::int32_t simplec_cpu_level()
+{
+#if defined(__x86_64__)
+    // Checks every feature of every level individually, since hypervisors commonly hide some of them.
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return 1;
+    }
+    unsigned leaf1 = ecx;
+    unsigned leaf7 = 0;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        leaf7 = ebx;
+    }
+    unsigned extendedLeaf1 = 0;
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+    {
+        extendedLeaf1 = ecx;
+    }
+    auto all = [](unsigned value, std::initializer_list<unsigned> bits)
+    {
+        return std::all_of(bits.begin(), bits.end(), [&](unsigned bit) { return (value >> bit & 1) != 0; });
+    };
+
+    // SSE3, SSSE3, CMPXCHG16B, SSE4.1, SSE4.2 and POPCNT; LAHF/SAHF.
+    if (!all(leaf1, {0, 9, 13, 19, 20, 23}) || !all(extendedLeaf1, {0}))
+    {
+        return 1;
+    }
+    // FMA, MOVBE, OSXSAVE, AVX and F16C; BMI1, AVX2 and BMI2; LZCNT.
+    if (!all(leaf1, {12, 22, 27, 28, 29}) || !all(leaf7, {3, 5, 8}) || !all(extendedLeaf1, {5}))
+    {
+        return 2;
+    }
+    // Whether the operating system saves the registers, as enabled in XCR0.
+    unsigned xcr0, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+    // SSE and AVX state.
+    if (!all(xcr0, {1, 2}))
+    {
+        return 2;
+    }
+    // AVX512F, AVX512DQ, AVX512CD, AVX512BW and AVX512VL; opmask, upper halves of ZMM0-15 and ZMM16-31 state.
+    if (!all(leaf7, {16, 17, 28, 30, 31}) || !all(xcr0, {5, 6, 7}))
+    {
+        return 3;
+    }
+    return 4;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+/// Functions called by code generated by SimpleC. They have C linkage so that generated code can refer to them by
+/// name, and are built into 'SimpleCRuntime', which has to be linked into any program containing such code.
+extern "C"
+{
+    /// Calls 'body' with disjoint subranges covering ['begin', 'end') and 'context', spread over a pool of worker
+    /// threads that steal ranges from each other. Returns once all iterations have run. Calls from within 'body' run
+    /// serially on the calling thread.
+    ///
+    /// The pool is created on first use with one thread per core, the calling thread included. The environment
+    /// variable 'SIMPLEC_NUM_THREADS' overrides the number of threads.
+    void simplec_parallel_for(std::int64_t begin, std::int64_t end,
+                              void (*body)(std::int64_t begin, std::int64_t end, void* context), void* context);
+
+    /// Returns the counters of the calling thread for the instrumented function 'name': the number of calls, of loop
+    /// iterations and of cycles spent in it, in that order. 'id' points to an integer owned by the function, which
+    /// must start out as -1 and is used to find the counters quickly on later calls.
+    ///
+    /// Counters of all threads are summed up and printed as a flat profile when the program exits, to standard error
+    /// or, if set, to the file named by the environment variable 'SIMPLEC_PROFILE'.
+    std::uint64_t* simplec_profile_enter(std::int64_t* id, const char* name);
+
+    /// Returns the highest level of the x86-64 psABI the CPU and operating system support, from 1 for the baseline to
+    /// 4 for AVX-512, or 0 on other architectures. Selects the versions of multiversioned functions.
+    std::int32_t simplec_cpu_level();
+}
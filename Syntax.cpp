@@ -0,0 +1,26 @@
+#include "Syntax.hpp"
+
+void destroyIteratively(std::unique_ptr<Expression>&& expression)
+{
+    thread_local std::vector<std::unique_ptr<Expression>> pending;
+    thread_local bool draining = false;
+
+    if (!expression)
+    {
+        return;
+    }
+    pending.push_back(std::move(expression));
+    // Destructors of nested nodes end up here again. They only queue their children for the outermost call to free.
+    if (draining)
+    {
+        return;
+    }
+    draining = true;
+    while (!pending.empty())
+    {
+        auto next = std::move(pending.back());
+        pending.pop_back();
+        next.reset();
+    }
+    draining = false;
+}
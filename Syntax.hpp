@@ -10,13 +10,113 @@
 
 #include "Lexer.hpp"
 
-/// <type> ::= 'int' | 'double'
+/// <type> ::= 'int' | 'double' | 'i8' | 'i16' | 'i64' | 'float' | 'bool'
+///            | ( 'vec2' | 'vec4' | 'vec8' ) '<' ( 'int' | 'double' ) '>'
+///
+/// 'int' is the 32 bit integer. All integers are signed.
+///
+/// Vectors hold a fixed number of lanes and map to SIMD registers. Arithmetic and comparisons apply lane by lane, with
+/// comparisons producing 1 or 0 in every lane of an 'int' vector. Scalars are broadcast to every lane when they meet a
+/// vector, or when converted to one using 'as'.
 enum class Type
 {
     Integer,
     Double,
+    Int8,
+    Int16,
+    Int64,
+    Float,
+    Bool,
+    Vec2Int,
+    Vec4Int,
+    Vec8Int,
+    Vec2Double,
+    Vec4Double,
+    Vec8Double,
 };
 
+inline bool isVector(Type type)
+{
+    switch (type)
+    {
+        case Type::Vec2Int:
+        case Type::Vec4Int:
+        case Type::Vec8Int:
+        case Type::Vec2Double:
+        case Type::Vec4Double:
+        case Type::Vec8Double: return true;
+        default: return false;
+    }
+}
+
+/// The type of the lanes of a vector, or 'type' itself for scalars.
+inline Type elementType(Type type)
+{
+    switch (type)
+    {
+        case Type::Vec2Int:
+        case Type::Vec4Int:
+        case Type::Vec8Int: return Type::Integer;
+        case Type::Vec2Double:
+        case Type::Vec4Double:
+        case Type::Vec8Double: return Type::Double;
+        default: return type;
+    }
+}
+
+/// The number of lanes of a vector, 1 for scalars.
+inline unsigned laneCount(Type type)
+{
+    switch (type)
+    {
+        case Type::Vec2Int:
+        case Type::Vec2Double: return 2;
+        case Type::Vec4Int:
+        case Type::Vec4Double: return 4;
+        case Type::Vec8Int:
+        case Type::Vec8Double: return 8;
+        default: return 1;
+    }
+}
+
+/// The vector of 'lanes' lanes of type 'element', if there is one.
+inline std::optional<Type> vectorType(Type element, unsigned lanes)
+{
+    std::optional<Type> result;
+    for (Type iter : {Type::Vec2Int, Type::Vec4Int, Type::Vec8Int, Type::Vec2Double, Type::Vec4Double,
+                      Type::Vec8Double})
+    {
+        if (elementType(iter) == element && laneCount(iter) == lanes)
+        {
+            result = iter;
+        }
+    }
+    return result;
+}
+
+/// True for 'float', 'double' and vectors of 'double'.
+inline bool isFloatingPoint(Type type)
+{
+    return elementType(type) == Type::Float || elementType(type) == Type::Double;
+}
+
+/// Orders types by the range of values they can represent. When two types meet in a binary operation, the operand of
+/// lower rank is implicitly converted to the type of higher rank. Vectors rank as their lanes.
+inline int conversionRank(Type type)
+{
+    switch (elementType(type))
+    {
+        case Type::Bool: return 0;
+        case Type::Int8: return 1;
+        case Type::Int16: return 2;
+        case Type::Integer: return 3;
+        case Type::Int64: return 4;
+        case Type::Float: return 5;
+        case Type::Double: return 6;
+        default: return 0;
+    }
+}
+
 struct Statement;
 
 struct Expression;
@@ -26,6 +126,8 @@ struct VarDecl
     std::string identifier;
     Type type;
     std::unique_ptr<Expression> initializer; // NULLABLE
+    /// Index of the variable within its function. Parameters occupy the first slots, in order.
+    std::size_t slot = 0;
 
     VarDecl(std::string identifier, Type type, std::unique_ptr<Expression>&& initializer = {})
         : identifier(std::move(identifier)), type(type), initializer(std::move(initializer))
@@ -33,15 +135,31 @@ struct VarDecl
     }
 };
 
-/// <function> ::= 'fun' IDENTIFIER '(' [ <param> { ',' <param> } ')' ':' <type> '{' { <statement> } '}'
+/// <function> ::= [ 'export' ] 'fun' IDENTIFIER '(' [ <param> { ',' <param> } ')' ':' <type>
+///                '{' { <statement> } '}'
+///              | 'extern' 'fun' IDENTIFIER '(' [ <param> { ',' <param> } ')' ':' <type> ';'
 ///
 /// <param> ::= IDENTIFIER ':' <type>
+///
+/// 'extern' functions have no body and are defined outside of the file, using the C calling convention. They must not
+/// throw.
+///
+/// Only 'export'ed functions are visible outside of the shared library or executable the file ends up in. Functions
+/// that are not exported may still be called from other object files of the same link, which is what keeps separately
+/// compiled pieces of a program working, but whole-program optimization assumes that they are not (see 'optimize').
 struct Function
 {
     std::string identifier;
     std::vector<std::unique_ptr<VarDecl>> parameters;
     Type returnType;
     std::vector<Statement> body;
+    /// Index of the function within its file, in order of definition.
+    std::size_t index = 0;
+    /// Number of 'VarDecl's, including parameters, declared within the function.
+    std::size_t slotCount = 0;
+    bool external = false;
+    bool exported = false;
+    std::size_t line = 0;
 
     Function(std::string identifier, std::vector<std::unique_ptr<VarDecl>> parameters, Type returnType)
         : identifier(std::move(identifier)), parameters(std::move(parameters)), returnType(returnType)
@@ -49,18 +167,60 @@ struct Function
     }
 };
 
-/// <statement> ::= 'if' <expression> '{' { <statement> } '}'
-///               | 'while' <expression> '{' { <statement> } '}'
+/// Expected outcome of a condition, as annotated by the programmer.
+enum class Likelihood
+{
+    Unknown,
+    Likely,
+    Unlikely,
+};
+
+/// Transformations requested for a loop. Counts of 0 leave the choice to the optimizer.
+struct LoopHints
+{
+    /// Set by 'unroll' without a count, which asks for unrolling the loop completely if its trip count is known.
+    bool unroll = false;
+    /// Set by 'unroll(N)'. 'unroll(1)' disables unrolling.
+    unsigned unrollCount = 0;
+    /// Set by 'vectorize', with or without options. Like '#pragma clang loop vectorize(enable)', this allows the
+    /// optimizer to reassociate floating point reductions within the loop.
+    bool vectorize = false;
+    unsigned vectorizeWidth = 0;
+    unsigned interleaveCount = 0;
+
+    [[nodiscard]] bool empty() const
+    {
+        return !unroll && unrollCount == 0 && !vectorize;
+    }
+};
+
+/// <statement> ::= 'if' [ <likelihood> ] <expression> '{' { <statement> } '}'
+///               | 'while' { <loop-hint> } [ <likelihood> ] <expression> '{' { <statement> } '}'
 ///               | 'return' <expression> ';'
 ///               | IDENTIFIER '=' <expression> ';'
 ///               | <expression> ';'
 ///               | 'var' IDENTIFIER [':' <type> ] [ '=' <expression> ] ';'
+///               | 'parallel' 'for' IDENTIFIER '=' <expression> ',' <expression> { <reduction> }
+///                 '{' { <statement> } '}'
+///
+/// <reduction> ::= 'reduce' ( '+' | '*' ) IDENTIFIER
+///
+/// <likelihood> ::= 'likely' | 'unlikely'
+///
+/// <loop-hint> ::= 'unroll' [ '(' INTEGER ')' ]
+///               | 'vectorize' [ '(' <vectorize-option> { ',' <vectorize-option> } ')' ]
+///
+/// <vectorize-option> ::= ( 'width' | 'interleave' ) '=' INTEGER
+///
+/// A '(' directly after 'unroll' or 'vectorize' always starts its options, never the condition.
 struct Statement
 {
     struct IfStatement
     {
         std::unique_ptr<Expression> condition;
         std::vector<Statement> body;
+        /// Likelihood of 'condition' being true.
+        Likelihood likelihood = Likelihood::Unknown;
     };
 
     struct ReturnStatement
@@ -72,6 +232,9 @@ struct Statement
     {
         std::unique_ptr<Expression> condition;
         std::vector<Statement> body;
+        /// Likelihood of 'condition' being true, i.e. of running another iteration.
+        Likelihood likelihood = Likelihood::Unknown;
+        LoopHints hints;
     };
 
     struct Assignment
@@ -80,9 +243,32 @@ struct Statement
         std::unique_ptr<Expression> value;
     };
 
+    /// Runs 'body' once for every value of 'induction' in ['begin', 'end'), spread over all cores in unspecified order.
+    /// Variables declared outside of the loop are read-only within 'body', except for the 'reductions': Every chunk of
+    /// iterations works on a private copy of those, starting at the identity of the operation, which is combined into
+    /// the variable at the end of the chunk.
+    struct ParallelFor
+    {
+        struct Reduction
+        {
+            Token::TokenType operation;
+            VarDecl* variable;
+        };
+
+        std::unique_ptr<VarDecl> induction;
+        std::unique_ptr<Expression> begin;
+        std::unique_ptr<Expression> end;
+        std::vector<Reduction> reductions;
+        /// Variables declared outside of the loop and read within 'body', excluding 'reductions'.
+        std::vector<VarDecl*> captures;
+        std::vector<Statement> body;
+    };
+
     std::variant<IfStatement, WhileStatement, ReturnStatement, Assignment, std::unique_ptr<Expression>,
-                 std::unique_ptr<VarDecl>>
+                 std::unique_ptr<VarDecl>, ParallelFor>
         variant;
+    /// Line the statement starts on.
+    std::size_t line = 0;
 };
 
 /// <expression> ::= <or-expression> [ 'as' <type> ]
@@ -97,12 +283,15 @@ struct Statement
 ///
 /// <mul-expression> ::= <unary-expression> { ('*' | '/') <unary-expression> }
 ///
-/// <unary-expression> ::= [ '-' ] <postfix-expression>
+/// <unary-expression> ::= { '-' } <postfix-expression>
 ///
 /// <postfix-expression> ::= <atom>
 ///                      | IDENTIFIER '(' [ <expression> { ',' <expression> } ] ')'
 ///
-/// <atom> ::= INTEGER | DECIMAL | IDENTIFIER | '(' <expression> ')'
+/// Calls to one of the 'BuiltinExpression's, unless a function of the same name is defined, have the same syntax as
+/// calls to functions.
+///
+/// <atom> ::= INTEGER | DECIMAL | 'true' | 'false' | IDENTIFIER | '(' <expression> ')'
 struct Expression
 {
     Type type;
@@ -112,6 +301,10 @@ struct Expression
     explicit Expression(Type type) : type(type) {}
 };
 
+/// Destroys 'expression' without recursing into its children. Nodes owning children must pass them to this function
+/// in their destructor, so that arbitrarily deep trees can be freed in constant stack space.
+void destroyIteratively(std::unique_ptr<Expression>&& expression);
+
 struct BinaryExpression : Expression
 {
     std::unique_ptr<Expression> lhs;
@@ -123,6 +316,12 @@ struct BinaryExpression : Expression
         : Expression(type), lhs(std::move(lhs)), operation(operation), rhs(std::move(rhs))
     {
     }
+
+    ~BinaryExpression() override
+    {
+        destroyIteratively(std::move(lhs));
+        destroyIteratively(std::move(rhs));
+    }
 };
 
 struct NegateExpression : Expression
@@ -132,6 +331,11 @@ struct NegateExpression : Expression
     NegateExpression(Type type, std::unique_ptr<Expression>&& operand) : Expression(type), operand(std::move(operand))
     {
     }
+
+    ~NegateExpression() override
+    {
+        destroyIteratively(std::move(operand));
+    }
 };
 
 /// Implicit and explicit!
@@ -140,6 +344,11 @@ struct CastExpression : Expression
     std::unique_ptr<Expression> operand;
 
     CastExpression(Type type, std::unique_ptr<Expression>&& operand) : Expression(type), operand(std::move(operand)) {}
+
+    ~CastExpression() override
+    {
+        destroyIteratively(std::move(operand));
+    }
 };
 
 struct CallExpression : Expression
@@ -151,16 +360,93 @@ struct CallExpression : Expression
         : Expression(type), function(function), arguments(std::move(arguments))
     {
     }
+
+    ~CallExpression() override
+    {
+        for (auto& iter : arguments)
+        {
+            destroyIteratively(std::move(iter));
+        }
+    }
+};
+
+/// Vector operations without an operator of their own:
+///
+///     extract(v, i)       Lane 'i' of 'v'.
+///     insert(v, i, x)     'v' with lane 'i' replaced by 'x'.
+///     sum(v), product(v)  The sum or product of all lanes.
+///     min(v), max(v)      The smallest or largest lane.
+///
+/// Lane indices wrap around modulo the number of lanes.
+struct BuiltinExpression : Expression
+{
+    enum Kind
+    {
+        Extract,
+        Insert,
+        Sum,
+        Product,
+        Min,
+        Max,
+    };
+    Kind kind;
+    std::vector<std::unique_ptr<Expression>> arguments;
+
+    BuiltinExpression(Type type, Kind kind, std::vector<std::unique_ptr<Expression>> arguments)
+        : Expression(type), kind(kind), arguments(std::move(arguments))
+    {
+    }
+
+    ~BuiltinExpression() override
+    {
+        for (auto& iter : arguments)
+        {
+            destroyIteratively(std::move(iter));
+        }
+    }
 };
 
 struct Atom : Expression
 {
-    using Variant = std::variant<int, double, VarDecl*>;
+    using Variant = std::variant<std::int64_t, double, bool, VarDecl*>;
     Variant valueOrVar;
 
     Atom(Type type, Variant variant) : Expression(type), valueOrVar(variant) {}
 };
 
+/// Calls 'f' with every direct operand of 'expression', from left to right.
+template <class F>
+void forEachOperand(const Expression& expression, F&& f)
+{
+    if (auto* binary = dynamic_cast<const BinaryExpression*>(&expression))
+    {
+        f(*binary->lhs);
+        f(*binary->rhs);
+    }
+    else if (auto* negate = dynamic_cast<const NegateExpression*>(&expression))
+    {
+        f(*negate->operand);
+    }
+    else if (auto* cast = dynamic_cast<const CastExpression*>(&expression))
+    {
+        f(*cast->operand);
+    }
+    else if (auto* call = dynamic_cast<const CallExpression*>(&expression))
+    {
+        for (auto& iter : call->arguments)
+        {
+            f(*iter);
+        }
+    }
+    else if (auto* builtin = dynamic_cast<const BuiltinExpression*>(&expression))
+    {
+        for (auto& iter : builtin->arguments)
+        {
+            f(*iter);
+        }
+    }
+}
+
 /// <file> ::= { <function> }
 struct File
 {
@@ -0,0 +1,378 @@
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/WithColor.h>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "Driver.hpp"
+#include "Error.hpp"
+
+/// Times the code generated by SimpleC for every kernel in 'bench/kernels', through both the JIT and the AOT path and
+/// at every optimization level, against the equivalent C kernel compiled by a baseline compiler at the same level.
+///
+/// Every kernel consists of '<name>.sc' and '<name>.c', both defining a function 'run' taking the problem size as
+/// 'int'. SimpleC kernels have to export it.
+
+namespace
+{
+llvm::cl::opt<std::string> kernelDirectory(llvm::cl::Positional, llvm::cl::desc("<kernel directory>"),
+                                           llvm::cl::Required);
+
+llvm::cl::opt<std::string> outputFilename("o", llvm::cl::desc("Output file for the JSON results"),
+                                          llvm::cl::value_desc("filename"), llvm::cl::init("-"));
+
+llvm::cl::opt<unsigned> repetitions("repetitions", llvm::cl::desc("Runs per measurement, the fastest one is reported"),
+                                    llvm::cl::init(5));
+
+llvm::cl::list<std::string> kernelFilter("kernel", llvm::cl::desc("Only run the given kernels"),
+                                         llvm::cl::CommaSeparated);
+
+llvm::cl::opt<std::string> targetCPU("mcpu",
+                                     llvm::cl::desc("Target CPU for SimpleC and, as '-march', for the baseline"),
+                                     llvm::cl::value_desc("cpu-name"));
+
+llvm::cl::opt<std::string> baselineCompiler("baseline-cc", llvm::cl::desc("C compiler used for the baseline"),
+                                            llvm::cl::init(SIMPLEC_BASELINE_CC));
+
+llvm::cl::opt<std::string> linker("linker", llvm::cl::desc("Compiler driver used to link AOT objects"),
+                                  llvm::cl::init(SIMPLEC_LINKER_CC));
+
+llvm::cl::opt<bool> perfMap("perf-map", llvm::cl::desc("Write '/tmp/perf-<pid>.map' for JIT compiled kernels"));
+
+llvm::cl::opt<bool> jitdump("jitdump", llvm::cl::desc("Write a jitdump file for JIT compiled kernels"));
+
+llvm::cl::opt<bool> debugInfo("g", llvm::cl::desc("Compile kernels with line info"));
+
+llvm::cl::opt<bool> wholeProgram("whole-program",
+                                 llvm::cl::desc("Optimize kernels as whole programs, which only export 'run'"));
+
+llvm::cl::opt<bool> instrument("instrument",
+                               llvm::cl::desc("Compile kernels with call and loop counters to measure their overhead. "
+                                              "The profile is printed at exit"));
+
+llvm::cl::opt<bool> instrumentCycles("instrument-cycles",
+                                     llvm::cl::desc("Like -instrument, also reading cycle counters"));
+
+struct Kernel
+{
+    const char* name;
+    bool returnsDouble;
+    int problemSize;
+};
+
+constexpr Kernel KERNELS[] = {
+    {"fib", false, 32},
+    {"loops", false, 4000},
+    {"doubles", true, 50000000},
+    {"calls", false, 50000000},
+    {"collatz", false, 1000000},
+    {"norms", true, 50000000},
+    {"simd", true, 12500000},
+};
+
+struct Measurement
+{
+    double seconds;
+    double result;
+};
+
+[[noreturn]] void fatal(const llvm::Twine& message)
+{
+    llvm::WithColor::error() << message << '\n';
+    std::exit(1);
+}
+
+template <class T>
+T exitOnError(llvm::Expected<T>&& expected)
+{
+    if (!expected)
+    {
+        fatal(llvm::toString(expected.takeError()));
+    }
+    return std::move(*expected);
+}
+
+Measurement measure(const Kernel& kernel, void* function)
+{
+    std::function<double()> call;
+    if (kernel.returnsDouble)
+    {
+        auto* typed = reinterpret_cast<double (*)(int)>(function);
+        call = [=] { return typed(kernel.problemSize); };
+    }
+    else
+    {
+        auto* typed = reinterpret_cast<int (*)(int)>(function);
+        call = [=] { return static_cast<double>(typed(kernel.problemSize)); };
+    }
+
+    Measurement best{std::numeric_limits<double>::infinity(), 0};
+    for (unsigned i = 0; i < repetitions; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        double result = call();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best.seconds = std::min(best.seconds, elapsed.count());
+        best.result = result;
+    }
+    return best;
+}
+
+void run(llvm::StringRef program, llvm::ArrayRef<llvm::StringRef> arguments)
+{
+    std::vector<llvm::StringRef> argv{program};
+    argv.insert(argv.end(), arguments.begin(), arguments.end());
+    std::string errorMessage;
+    if (llvm::sys::ExecuteAndWait(program, argv, llvm::None, {}, 0, 0, &errorMessage) != 0)
+    {
+        fatal("'" + program + "' failed: " + errorMessage);
+    }
+}
+
+/// Loads the shared library at 'path' and returns the address of its 'run' function. The library stays loaded until
+/// the process exits.
+void* loadRun(const std::string& path)
+{
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        fatal(dlerror());
+    }
+    return dlsym(handle, "run");
+}
+
+std::string readSource(const Kernel& kernel)
+{
+    llvm::SmallString<128> path(kernelDirectory);
+    llvm::sys::path::append(path, llvm::Twine(kernel.name) + ".sc");
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer)
+    {
+        fatal("could not open '" + path + "': " + buffer.getError().message());
+    }
+    return (*buffer)->getBuffer().str();
+}
+
+CodegenOptions codegenOptions(const Kernel& kernel)
+{
+    CodegenOptions options;
+    if (fastMathOption())
+    {
+        options.fastMath.setFast();
+    }
+    options.debugInfo = debugInfo;
+    options.instrument = instrument || instrumentCycles;
+    options.instrumentCycles = instrumentCycles;
+    llvm::SmallString<128> path(kernelDirectory);
+    llvm::sys::path::append(path, llvm::Twine(kernel.name) + ".sc");
+    options.sourceFileName = path.str().str();
+    return options;
+}
+
+std::unique_ptr<llvm::Module> compileKernel(const Kernel& kernel, llvm::LLVMContext& context, unsigned optLevel,
+                                            llvm::TargetMachine& targetMachine)
+{
+    std::unique_ptr<llvm::Module> module;
+    try
+    {
+        module = compile(readSource(kernel), context, &targetMachine, codegenOptions(kernel));
+    }
+    catch (const CompileError& e)
+    {
+        fatal(llvm::Twine(kernel.name) + ".sc: " + e.what());
+    }
+    optimize(*module, optLevel, &targetMachine, wholeProgram);
+    return module;
+}
+
+Measurement runJIT(const Kernel& kernel, unsigned optLevel, llvm::TargetMachine& targetMachine)
+{
+    auto builder = exitOnError(llvm::orc::JITTargetMachineBuilder::detectHost());
+    builder.setCodeGenOptLevel(codeGenOptLevel(optLevel));
+    llvm::orc::LLJITBuilder jitBuilder;
+    jitBuilder.setJITTargetMachineBuilder(std::move(builder));
+    enableProfiling(jitBuilder, {perfMap, jitdump});
+    auto jit = exitOnError(jitBuilder.create());
+
+    if (auto error = addHostSymbols(*jit))
+    {
+        fatal(llvm::toString(std::move(error)));
+    }
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = compileKernel(kernel, *context, optLevel, targetMachine);
+    if (auto error = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context))))
+    {
+        fatal(llvm::toString(std::move(error)));
+    }
+    auto symbol = exitOnError(jit->lookup("run"));
+    return measure(kernel, reinterpret_cast<void*>(symbol.getAddress()));
+}
+
+/// Like 'runJIT', but compiles the kernel one function at a time using 'compileStreaming', which gives up on inlining
+/// across functions.
+Measurement runJITStreaming(const Kernel& kernel, unsigned optLevel)
+{
+    auto builder = exitOnError(llvm::orc::JITTargetMachineBuilder::detectHost());
+    auto jit = exitOnError(llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(builder)).create());
+    if (auto error = addHostSymbols(*jit))
+    {
+        fatal(llvm::toString(std::move(error)));
+    }
+
+    StreamingOptions options{llvm::Triple(llvm::sys::getProcessTriple()), optLevel, targetCPU, "",
+                             codegenOptions(kernel)};
+    try
+    {
+        auto error = compileStreaming(readSource(kernel), options,
+                                      [&](std::size_t, llvm::StringRef, std::unique_ptr<llvm::MemoryBuffer> object)
+                                      { return jit->addObjectFile(std::move(object)); });
+        if (error)
+        {
+            fatal(llvm::toString(std::move(error)));
+        }
+    }
+    catch (const CompileError& e)
+    {
+        fatal(llvm::Twine(kernel.name) + ".sc: " + e.what());
+    }
+    auto symbol = exitOnError(jit->lookup("run"));
+    return measure(kernel, reinterpret_cast<void*>(symbol.getAddress()));
+}
+
+Measurement runAOT(const Kernel& kernel, unsigned optLevel, llvm::TargetMachine& targetMachine,
+                   llvm::StringRef workDirectory)
+{
+    llvm::LLVMContext context;
+    auto module = compileKernel(kernel, context, optLevel, targetMachine);
+
+    std::string base = (workDirectory + "/" + kernel.name + "-O" + llvm::Twine(optLevel)).str();
+    std::string object = base + ".o";
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream os(object, ec);
+        if (ec)
+        {
+            fatal("could not open '" + object + "': " + ec.message());
+        }
+        if (auto error = emitFile(*module, targetMachine, llvm::CGFT_ObjectFile, os))
+        {
+            fatal(llvm::toString(std::move(error)));
+        }
+    }
+    std::string library = base + "-aot.so";
+    run(linker, {"-shared", "-o", library, object});
+    return measure(kernel, loadRun(library));
+}
+
+Measurement runBaseline(const Kernel& kernel, unsigned optLevel, llvm::StringRef workDirectory)
+{
+    llvm::SmallString<128> source(kernelDirectory);
+    llvm::sys::path::append(source, llvm::Twine(kernel.name) + ".c");
+    std::string library = (workDirectory + "/" + kernel.name + "-O" + llvm::Twine(optLevel) + "-baseline.so").str();
+    std::string level = "-O" + std::to_string(optLevel);
+    std::vector<llvm::StringRef> arguments{level, "-fPIC", "-shared", "-o", library, source};
+    std::string march = "-march=" + targetCPU;
+    if (!targetCPU.empty())
+    {
+        arguments.push_back(march);
+    }
+    if (fastMathOption())
+    {
+        arguments.push_back("-ffast-math");
+    }
+    run(baselineCompiler, arguments);
+    return measure(kernel, loadRun(library));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    llvm::InitLLVM initLLVM(argc, argv);
+    fastMathOption();
+    llvm::cl::ParseCommandLineOptions(argc, argv, "SimpleC runtime benchmarks\n");
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    llvm::SmallString<128> workDirectory;
+    if (auto ec = llvm::sys::fs::createUniqueDirectory("simplec-bench", workDirectory))
+    {
+        fatal("could not create a temporary directory: " + ec.message());
+    }
+
+    llvm::Triple host(llvm::sys::getProcessTriple());
+
+    std::error_code ec;
+    llvm::raw_fd_ostream output(outputFilename, ec, llvm::sys::fs::OF_Text);
+    if (ec)
+    {
+        fatal("could not open '" + outputFilename + "': " + ec.message());
+    }
+    llvm::json::OStream json(output, 2);
+    json.objectBegin();
+    json.attribute("host", host.str());
+    json.attribute("cpu", llvm::sys::getHostCPUName());
+    json.attribute("target_cpu", targetCPU);
+    json.attribute("fast_math", fastMathOption().getValue());
+    json.attribute("whole_program", wholeProgram.getValue());
+    json.attribute("baseline_compiler", baselineCompiler);
+    json.attribute("repetitions", static_cast<int64_t>(repetitions));
+    json.attributeArray(
+        "results",
+        [&]
+        {
+            for (const auto& kernel : KERNELS)
+            {
+                if (!kernelFilter.empty() && llvm::find(kernelFilter, kernel.name) == kernelFilter.end())
+                {
+                    continue;
+                }
+                for (unsigned optLevel = 0; optLevel <= 3; optLevel++)
+                {
+                    auto targetMachine = exitOnError(createTargetMachine(host, optLevel, targetCPU));
+                    auto baseline = runBaseline(kernel, optLevel, workDirectory);
+                    auto emit = [&](llvm::StringRef mode, const Measurement& measurement)
+                    {
+                        llvm::errs() << kernel.name << " -O" << optLevel << " " << mode << ": "
+                                     << llvm::format("%.4f", measurement.seconds) << "s\n";
+                        json.object(
+                            [&]
+                            {
+                                json.attribute("kernel", kernel.name);
+                                json.attribute("opt_level", static_cast<int64_t>(optLevel));
+                                json.attribute("mode", mode);
+                                json.attribute("problem_size", static_cast<int64_t>(kernel.problemSize));
+                                json.attribute("seconds", measurement.seconds);
+                                json.attribute("relative_to_baseline", measurement.seconds / baseline.seconds);
+                                json.attribute("result", measurement.result);
+                                json.attribute("matches_baseline", measurement.result == baseline.result);
+                            });
+                    };
+                    emit("baseline", baseline);
+                    emit("jit", runJIT(kernel, optLevel, *targetMachine));
+                    emit("jit-stream", runJITStreaming(kernel, optLevel));
+                    emit("aot", runAOT(kernel, optLevel, *targetMachine, workDirectory));
+                }
+            }
+        });
+    json.objectEnd();
+    output << '\n';
+
+    llvm::sys::fs::remove_directories(workDirectory);
+}
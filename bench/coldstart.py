@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""Measures the cold-start latency of the SimpleC executable.
+
+Every run spawns a fresh process compiling the given input, so the numbers include dynamic loading, static
+initializers and target initialization, which dominate for small inputs.
+
+Usage: coldstart.py <SimpleC executable> <input file> [runs] [extra compiler arguments...]
+"""
+
+import statistics
+import subprocess
+import sys
+import time
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    executable, source = sys.argv[1], sys.argv[2]
+    runs = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+    command = [executable, source] + sys.argv[4:]
+
+    # Warm up the page cache so the first sample is not an outlier.
+    subprocess.run(command, stdout=subprocess.DEVNULL, check=True)
+
+    samples = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(command, stdout=subprocess.DEVNULL, check=True)
+        samples.append((time.perf_counter() - start) * 1e3)
+
+    samples.sort()
+    print(f"runs:   {runs}")
+    print(f"min:    {samples[0]:.3f} ms")
+    print(f"median: {statistics.median(samples):.3f} ms")
+    print(f"p90:    {samples[int(len(samples) * 0.9)]:.3f} ms")
+    print(f"mean:   {statistics.mean(samples):.3f} ms")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,20 @@
+int square(int x)
+{
+    return x * x;
+}
+
+int mix(int a, int b)
+{
+    return square(a) - square(b) + a / (b + 1);
+}
+
+/* 'acc' wraps around, which is well defined in SimpleC but not for signed integers in C. */
+int run(int n)
+{
+    unsigned acc = 0;
+    for (int i = 0; i < n; i++)
+    {
+        acc = acc + (unsigned)mix(i / 1024, i - i / 1024 * 1024);
+    }
+    return (int)acc;
+}
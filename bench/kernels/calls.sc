@@ -0,0 +1,17 @@
+fun square(x: int): int {
+    return x * x;
+}
+
+fun mix(a: int, b: int): int {
+    return square(a) - square(b) + a / (b + 1);
+}
+
+export fun run(n: int): int {
+    var acc = 0;
+    var i = 0;
+    while i < n {
+        acc = acc + mix(i / 1024, i - i / 1024 * 1024);
+        i = i + 1;
+    }
+    return acc;
+}
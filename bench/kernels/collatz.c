@@ -0,0 +1,24 @@
+/* The SimpleC kernel spreads the outer loop over all cores, this one runs serially. */
+int run(int n)
+{
+    int steps = 0;
+    for (int i = 1; i < n + 1; i++)
+    {
+        long long x = i;
+        while (x != 1)
+        {
+            long long half = x / 2;
+            long long odd = x - half * 2;
+            if (odd == 0)
+            {
+                x = half;
+            }
+            if (odd == 1)
+            {
+                x = 3 * x + 1;
+            }
+            steps = steps + 1;
+        }
+    }
+    return steps;
+}
@@ -0,0 +1,18 @@
+export fun run(n: int): int {
+    var steps = 0;
+    parallel for i = 1, n + 1 reduce + steps {
+        var x: i64 = i;
+        while x != 1 {
+            var half = x / 2;
+            var odd = x - half * 2;
+            if odd == 0 {
+                x = half;
+            }
+            if odd == 1 {
+                x = 3 * x + 1;
+            }
+            steps = steps + 1;
+        }
+    }
+    return steps;
+}
@@ -0,0 +1,11 @@
+double run(int n)
+{
+    double sum = 0.0;
+    double sign = 1.0;
+    for (int i = 0; i < n; i++)
+    {
+        sum = sum + sign / (double)(2 * i + 1);
+        sign = -sign;
+    }
+    return 4.0 * sum;
+}
@@ -0,0 +1,11 @@
+export fun run(n: int): double {
+    var sum = 0.0;
+    var sign = 1.0;
+    var i = 0;
+    while i < n {
+        sum = sum + sign / (2 * i + 1);
+        sign = -sign;
+        i = i + 1;
+    }
+    return 4.0 * sum;
+}
@@ -0,0 +1,13 @@
+int fib(int x)
+{
+    if (x <= 1)
+    {
+        return 1;
+    }
+    return fib(x - 2) + fib(x - 1);
+}
+
+int run(int n)
+{
+    return fib(n);
+}
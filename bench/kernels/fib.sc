@@ -0,0 +1,10 @@
+fun fib(x: int): int {
+    if x <= 1 {
+        return 1;
+    }
+    return fib(x - 2) + fib(x - 1);
+}
+
+export fun run(n: int): int {
+    return fib(n);
+}
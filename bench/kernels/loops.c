@@ -0,0 +1,13 @@
+/* 'sum' wraps around, which is well defined in SimpleC but not for signed integers in C. */
+int run(int n)
+{
+    unsigned sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            sum = sum + (unsigned)(i * j) + (unsigned)((i + j) / 3);
+        }
+    }
+    return (int)sum;
+}
@@ -0,0 +1,13 @@
+export fun run(n: int): int {
+    var sum = 0;
+    var i = 0;
+    while i < n {
+        var j = 0;
+        while j < n {
+            sum = sum + i * j + (i + j) / 3;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    return sum;
+}
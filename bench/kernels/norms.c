@@ -0,0 +1,12 @@
+#include <math.h>
+
+double run(int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        double x = (double)i;
+        sum = sum + sqrt(x * x + 1.0);
+    }
+    return sum;
+}
@@ -0,0 +1,12 @@
+extern fun sqrt(x: double): double;
+
+export fun run(n: int): double {
+    var sum = 0.0;
+    var i = 0;
+    while i < n {
+        var x = i as double;
+        sum = sum + sqrt(x * x + 1.0);
+        i = i + 1;
+    }
+    return sum;
+}
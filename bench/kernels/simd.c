@@ -0,0 +1,13 @@
+typedef double double4 __attribute__((vector_size(32)));
+
+double run(int n)
+{
+    double4 acc = {0.0, 0.0, 0.0, 0.0};
+    double4 offsets = {0.0, 1.0, 2.0, 3.0};
+    for (int i = 0; i < n; i++)
+    {
+        double4 x = offsets + (double)(i * 4);
+        acc = acc + 1.0 / (x * x + 1.0);
+    }
+    return acc[0] + acc[1] + acc[2] + acc[3];
+}
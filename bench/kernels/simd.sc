@@ -0,0 +1,14 @@
+export fun run(n: int): double {
+    var acc: vec4<double> = 0.0;
+    var offsets: vec4<double> = 0.0;
+    offsets = insert(offsets, 1, 1.0);
+    offsets = insert(offsets, 2, 2.0);
+    offsets = insert(offsets, 3, 3.0);
+    var i = 0;
+    while i < n {
+        var x = offsets + i * 4;
+        acc = acc + 1.0 / (x * x + 1.0);
+        i = i + 1;
+    }
+    return sum(acc);
+}
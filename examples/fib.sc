@@ -0,0 +1,6 @@
+export fun fib(x: int): int {
+    if x <= 1 {
+        return 1;
+    }
+    return fib(x - 2) + fib(x - 1);
+}
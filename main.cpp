@@ -1,30 +1,464 @@
+#include <llvm/ADT/Triple.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/WithColor.h>
 
-#include "Codegen.hpp"
-#include "Parser.hpp"
+#include <iostream>
+#include <thread>
 
-int main()
+#include "CompileServer.hpp"
+#include "Driver.hpp"
+#include "Error.hpp"
+#include "Repl.hpp"
+
+namespace
 {
-    auto tokens = tokenize(R"(
+llvm::cl::opt<std::string> inputFilename(llvm::cl::Positional, llvm::cl::desc("<input file>"), llvm::cl::init("-"));
 
-fun fib(x: int): int {
-    if x <= 1 {
-        return 1;
-    }
-    return fib(x - 2) + fib(x - 1);
-}
+llvm::cl::opt<std::string> outputFilename("o", llvm::cl::desc("Output file"), llvm::cl::value_desc("filename"),
+                                          llvm::cl::init("-"));
+
+llvm::cl::opt<unsigned> optLevel("O", llvm::cl::desc("Optimization level (0-3)"), llvm::cl::Prefix, llvm::cl::init(0));
+
+enum class EmitKind
+{
+    LLVM,
+    Assembly,
+    Object,
+};
+
+llvm::cl::opt<EmitKind> emitKind("emit", llvm::cl::desc("Kind of output to produce"), llvm::cl::init(EmitKind::LLVM),
+                                 llvm::cl::values(clEnumValN(EmitKind::LLVM, "llvm", "Textual LLVM IR"),
+                                                  clEnumValN(EmitKind::Assembly, "asm", "Assembly file"),
+                                                  clEnumValN(EmitKind::Object, "obj", "Object file")));
+
+llvm::cl::opt<std::string> targetTriple("mtriple", llvm::cl::desc("Override the target triple of the module"),
+                                        llvm::cl::value_desc("triple"));
+
+llvm::cl::opt<std::string> targetCPU("mcpu",
+                                     llvm::cl::desc("Target CPU to generate code for, 'native' selects the host CPU"),
+                                     llvm::cl::value_desc("cpu-name"));
+
+llvm::cl::alias targetArch("march", llvm::cl::desc("Alias for -mcpu"), llvm::cl::aliasopt(targetCPU));
+
+llvm::cl::opt<std::string> targetFeatures("mattr",
+                                          llvm::cl::desc("Target features to enable (+feature) or disable (-feature)"),
+                                          llvm::cl::value_desc("a1,+a2,-a3,..."));
+
+llvm::cl::OptionCategory fastMathCategory("Floating point options");
+
+llvm::cl::opt<bool> associativeMath("fassociative-math",
+                                    llvm::cl::desc("Allow reassociation of floating point operations"),
+                                    llvm::cl::cat(fastMathCategory));
+
+llvm::cl::opt<bool> reciprocalMath("freciprocal-math",
+                                   llvm::cl::desc("Allow division to be replaced by multiplication with a reciprocal"),
+                                   llvm::cl::cat(fastMathCategory));
+
+llvm::cl::opt<bool> finiteMathOnly("ffinite-math-only",
+                                   llvm::cl::desc("Assume floating point values are never NaN or infinite"),
+                                   llvm::cl::cat(fastMathCategory));
+
+llvm::cl::opt<bool> noSignedZeros("fno-signed-zeros", llvm::cl::desc("Ignore the sign of floating point zeros"),
+                                  llvm::cl::cat(fastMathCategory));
+
+enum class FPContract
+{
+    Off,
+    Fast,
+};
+
+llvm::cl::opt<FPContract> fpContract(
+    "ffp-contract", llvm::cl::desc("Form fused floating point operations such as FMAs"),
+    llvm::cl::init(FPContract::Off),
+    llvm::cl::values(clEnumValN(FPContract::Off, "off", "Never fuse"),
+                     clEnumValN(FPContract::Fast, "fast", "Fuse across statements whenever profitable")),
+    llvm::cl::cat(fastMathCategory));
+
+llvm::cl::opt<bool> batchEntryPoints(
+    "batch", llvm::cl::desc("Also emit '<name>.batch', applying the function over arrays, for every function"));
+
+llvm::cl::opt<bool> debugInfo("g", llvm::cl::desc("Emit debug info mapping code to source lines"));
+
+llvm::cl::opt<bool> instrument("instrument",
+                               llvm::cl::desc("Count calls and loop iterations of every function and print a flat "
+                                              "profile at exit. Requires linking against SimpleCRuntime"));
+
+llvm::cl::opt<bool> instrumentCycles(
+    "instrument-cycles", llvm::cl::desc("Like -instrument, also measuring the cycles spent in every function"));
+
+llvm::cl::opt<bool> wholeProgram("whole-program",
+                                 llvm::cl::desc("Assume that only exported functions are called from outside of the "
+                                                "file. Deletes or inlines the others"));
+
+llvm::cl::opt<bool> foldCalls("fold-calls",
+                              llvm::cl::desc("Evaluate calls with constant arguments at compile time (default on)"),
+                              llvm::cl::init(true));
+
+llvm::cl::opt<bool> reportFolds("report-folds", llvm::cl::desc("Print a note for every call folded by -fold-calls"));
+
+llvm::cl::list<std::string> multiversion(
+    "multiversion",
+    llvm::cl::desc("Compile the given functions once per x86-64 level in -multiversion-levels besides the baseline, "
+                   "running the best version the CPU supports. Requires linking against SimpleCRuntime"),
+    llvm::cl::value_desc("function"), llvm::cl::CommaSeparated);
 
-)");
-    auto file = Parser(tokens.begin(), tokens.end()).parseFile();
+llvm::cl::list<unsigned> multiversionLevels(
+    "multiversion-levels",
+    llvm::cl::desc("x86-64 microarchitecture levels (2-4) to compile -multiversion functions for (default 3,4)"),
+    llvm::cl::CommaSeparated);
 
+llvm::cl::opt<bool> stream("stream",
+                           llvm::cl::desc("Compile one function at a time, keeping memory bounded by the largest "
+                                          "function. Requires -emit=obj and produces a static library holding an "
+                                          "object file per function"));
+
+llvm::cl::opt<unsigned> streamThreads("stream-threads",
+                                      llvm::cl::desc("Number of threads optimizing and emitting functions for -stream"),
+                                      llvm::cl::init(std::max(1u, std::thread::hardware_concurrency())));
+
+llvm::cl::opt<unsigned> codegenPartitions(
+    "codegen-partitions",
+    llvm::cl::desc("Split the optimized module into this many partitions and run the backend over them in parallel. "
+                   "Requires -emit=obj and produces a static library holding an object file per partition"),
+    llvm::cl::init(1));
+
+llvm::cl::opt<bool> repl("repl", llvm::cl::desc("Read function definitions and expressions from standard input, "
+                                                "compiling each and evaluating expressions as they are entered"));
+
+llvm::cl::opt<std::string> serveSocket("serve", llvm::cl::desc("Run as a compile server on the given Unix socket"),
+                                       llvm::cl::value_desc("socket path"));
+
+llvm::cl::opt<unsigned> serveThreads("serve-threads",
+                                     llvm::cl::desc("Number of worker threads and contexts used by -serve"),
+                                     llvm::cl::init(std::max(1u, std::thread::hardware_concurrency())));
+
+/// Registers only the targets needed to compile for 'triple'. Initializing every target LLVM was built with costs
+/// noticeably more startup time than the compilation of a small file, so the other targets are only brought in if
+/// a foreign triple was requested.
+bool initializeTargets(const llvm::Triple& triple)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    if (triple.getArch() == llvm::Triple(llvm::sys::getProcessTriple()).getArch())
+    {
+        return true;
+    }
+#ifdef SIMPLEC_NATIVE_ONLY
+    return false;
+#else
     llvm::InitializeAllTargetInfos();
     llvm::InitializeAllTargets();
     llvm::InitializeAllTargetMCs();
     llvm::InitializeAllAsmPrinters();
     llvm::InitializeAllAsmParsers();
+    return true;
+#endif
+}
+
+CodegenOptions codegenOptions()
+{
+    CodegenOptions options;
+    if (fastMathOption())
+    {
+        options.fastMath.setFast();
+    }
+    if (associativeMath)
+    {
+        options.fastMath.setAllowReassoc();
+    }
+    if (reciprocalMath)
+    {
+        options.fastMath.setAllowReciprocal();
+    }
+    if (finiteMathOnly)
+    {
+        options.fastMath.setNoNaNs();
+        options.fastMath.setNoInfs();
+    }
+    if (noSignedZeros)
+    {
+        options.fastMath.setNoSignedZeros();
+    }
+    if (fpContract == FPContract::Fast)
+    {
+        options.fastMath.setAllowContract();
+    }
+    options.batchEntryPoints = batchEntryPoints;
+    options.debugInfo = debugInfo;
+    options.instrument = instrument || instrumentCycles;
+    options.instrumentCycles = instrumentCycles;
+    options.foldConstantCalls = foldCalls;
+    options.multiversion = multiversion;
+    if (!multiversionLevels.empty())
+    {
+        options.versionLevels = multiversionLevels;
+    }
+    if (inputFilename != "-")
+    {
+        options.sourceFileName = inputFilename;
+    }
+    return options;
+}
+
+/// Writes the non-null 'objects' into a static library at the output path.
+int writeArchive(const std::vector<std::unique_ptr<llvm::MemoryBuffer>>& objects, const llvm::Triple& triple)
+{
+    std::vector<llvm::NewArchiveMember> members;
+    for (auto& iter : objects)
+    {
+        if (iter)
+        {
+            members.emplace_back(iter->getMemBufferRef());
+        }
+    }
+    auto archive = llvm::writeArchiveToBuffer(
+        members, true, triple.isOSDarwin() ? llvm::object::Archive::K_DARWIN : llvm::object::Archive::K_GNU, true,
+        false);
+    if (!archive)
+    {
+        llvm::WithColor::error() << llvm::toString(archive.takeError()) << '\n';
+        return 1;
+    }
+    std::error_code ec;
+    llvm::ToolOutputFile output(outputFilename, ec, llvm::sys::fs::OF_None);
+    if (ec)
+    {
+        llvm::WithColor::error() << "could not open '" << outputFilename << "': " << ec.message() << '\n';
+        return 1;
+    }
+    output.os() << (*archive)->getBuffer();
+    output.keep();
+    return 0;
+}
+
+/// Implements '-stream', writing the objects produced by 'compileStreaming' into a static library.
+int compileToArchive(std::string_view source, const llvm::Triple& triple)
+{
+    if (emitKind != EmitKind::Object)
+    {
+        llvm::WithColor::error() << "-stream requires -emit=obj\n";
+        return 1;
+    }
+    if (wholeProgram)
+    {
+        llvm::WithColor::error() << "-stream cannot be combined with -whole-program\n";
+        return 1;
+    }
+    StreamingOptions options{triple, optLevel, targetCPU, targetFeatures, codegenOptions(), streamThreads};
+    // Indexed by 'Function::index', so that the output does not depend on the order the threads finish in.
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+    auto consumer = [&](std::size_t index, llvm::StringRef, std::unique_ptr<llvm::MemoryBuffer> object)
+    {
+        if (objects.size() <= index)
+        {
+            objects.resize(index + 1);
+        }
+        objects[index] = std::move(object);
+        return llvm::Error::success();
+    };
+    try
+    {
+        if (auto error = compileStreaming(source, options, consumer))
+        {
+            llvm::WithColor::error() << llvm::toString(std::move(error)) << '\n';
+            return 1;
+        }
+    }
+    catch (const CompileError& e)
+    {
+        llvm::errs() << e.what() << '\n';
+        return 1;
+    }
+
+    return writeArchive(objects, triple);
+}
+
+/// Implements '-repl'.
+int runRepl()
+{
+    auto session = Repl::create(optLevel, codegenOptions());
+    if (!session)
+    {
+        llvm::WithColor::error() << llvm::toString(session.takeError()) << '\n';
+        return 1;
+    }
+    bool interactive = llvm::sys::Process::StandardInIsUserInput();
+    bool complete = true;
+    std::string line;
+    while (true)
+    {
+        if (interactive)
+        {
+            llvm::outs() << (complete ? "> " : ". ");
+            llvm::outs().flush();
+        }
+        if (!std::getline(std::cin, line))
+        {
+            break;
+        }
+        complete = (*session)->addLine(line, llvm::outs());
+        llvm::outs().flush();
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    llvm::InitLLVM initLLVM(argc, argv);
+    fastMathOption().addCategory(fastMathCategory);
+    fastMathOption().setHiddenFlag(llvm::cl::NotHidden);
+    fastMathOption().setDescription("Enable all of the floating point relaxations below");
+    llvm::cl::ParseCommandLineOptions(argc, argv, "SimpleC compiler\n");
+
+    llvm::Triple triple(targetTriple.empty() ? llvm::sys::getProcessTriple() : llvm::Triple::normalize(targetTriple));
+    if (!initializeTargets(triple))
+    {
+        llvm::WithColor::error() << "target '" << triple.str() << "' is not available in this native-only build\n";
+        return 1;
+    }
+
+    if (!multiversion.empty() && triple.getArch() != llvm::Triple::x86_64)
+    {
+        llvm::WithColor::error() << "-multiversion requires an x86-64 target\n";
+        return 1;
+    }
+    for (auto level : multiversionLevels)
+    {
+        if (level < 2 || level > 4)
+        {
+            llvm::WithColor::error() << "-multiversion-levels: level " << level << " is not between 2 and 4\n";
+            return 1;
+        }
+    }
+
+    if (codegenPartitions > 1 && emitKind != EmitKind::Object)
+    {
+        llvm::WithColor::error() << "-codegen-partitions requires -emit=obj\n";
+        return 1;
+    }
+    if (codegenPartitions > 1 && stream)
+    {
+        llvm::WithColor::error() << "-stream cannot be combined with -codegen-partitions\n";
+        return 1;
+    }
+
+    if (repl)
+    {
+        return runRepl();
+    }
+
+    if (!serveSocket.empty())
+    {
+        auto server = CompileServer::create(serveSocket, serveThreads);
+        if (!server)
+        {
+            llvm::WithColor::error() << llvm::toString(server.takeError()) << '\n';
+            return 1;
+        }
+        if (auto error = (*server)->run())
+        {
+            llvm::WithColor::error() << llvm::toString(std::move(error)) << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFileOrSTDIN(inputFilename);
+    if (!buffer)
+    {
+        llvm::WithColor::error() << "could not open '" << inputFilename << "': " << buffer.getError().message() << '\n';
+        return 1;
+    }
+
+    if (stream)
+    {
+        return compileToArchive((*buffer)->getBuffer(), triple);
+    }
+
+    auto targetMachine = createTargetMachine(triple, optLevel, targetCPU, targetFeatures);
+    if (!targetMachine)
+    {
+        llvm::WithColor::error() << llvm::toString(targetMachine.takeError()) << '\n';
+        return 1;
+    }
+
     llvm::LLVMContext context;
-    Codegen codegen(context);
-    codegen.visit(file);
-    auto* llvmModule = codegen.getModule();
-    llvmModule->print(llvm::outs(), nullptr);
+    std::unique_ptr<llvm::Module> llvmModule;
+    std::vector<FoldedCall> folded;
+    try
+    {
+        llvmModule = compile((*buffer)->getBuffer(), context, targetMachine->get(), codegenOptions(), &folded);
+    }
+    catch (const CompileError& e)
+    {
+        llvm::errs() << e.what() << '\n';
+        return 1;
+    }
+    for (auto& iter : multiversion)
+    {
+        if (!llvmModule->getGlobalVariable(iter + ".version", true))
+        {
+            llvm::WithColor::warning() << "-multiversion: no function named '" << iter << "' is defined\n";
+        }
+    }
+    if (reportFolds)
+    {
+        for (auto& iter : folded)
+        {
+            llvm::WithColor::note() << "line " << iter.line << ": " << iter.call << " folded to " << iter.value << '\n';
+        }
+    }
+    optimize(*llvmModule, optLevel, targetMachine->get(), wholeProgram);
+
+    if (codegenPartitions > 1)
+    {
+        std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects(codegenPartitions);
+        auto consumer = [&](std::size_t index, llvm::StringRef, std::unique_ptr<llvm::MemoryBuffer> object)
+        {
+            objects[index] = std::move(object);
+            return llvm::Error::success();
+        };
+        if (auto error = emitObjectsParallel(*llvmModule, **targetMachine, codegenPartitions, consumer))
+        {
+            llvm::WithColor::error() << llvm::toString(std::move(error)) << '\n';
+            return 1;
+        }
+        return writeArchive(objects, triple);
+    }
+
+    std::error_code ec;
+    llvm::ToolOutputFile output(outputFilename, ec,
+                                emitKind == EmitKind::Object ? llvm::sys::fs::OF_None : llvm::sys::fs::OF_Text);
+    if (ec)
+    {
+        llvm::WithColor::error() << "could not open '" << outputFilename << "': " << ec.message() << '\n';
+        return 1;
+    }
+    switch (emitKind)
+    {
+        case EmitKind::LLVM: llvmModule->print(output.os(), nullptr); break;
+        case EmitKind::Assembly:
+        case EmitKind::Object:
+        {
+            auto fileType = emitKind == EmitKind::Object ? llvm::CGFT_ObjectFile : llvm::CGFT_AssemblyFile;
+            if (auto error = emitFile(*llvmModule, **targetMachine, fileType, output.os()))
+            {
+                llvm::WithColor::error() << llvm::toString(std::move(error)) << '\n';
+                return 1;
+            }
+            break;
+        }
+    }
+    output.keep();
 }